@@ -10,38 +10,88 @@
 #include "cereal/types/set.hpp"
 
 namespace ants {
+    /// The 8 directions an ant can move in. The opposite of directions[i] is directions[7 - i].
+    inline const Vector2i directions[] = {Vector2i(-1, -1), Vector2i(-1, 0), Vector2i(-1, 1),
+                                          Vector2i(0, -1), Vector2i(0, 1),
+                                          Vector2i(1, -1), Vector2i(1, 0), Vector2i(1, 1)};
+
+    /**
+     * Packed ant record, this is what the update loop iterates over so it is kept as small as possible
+     * (8 bytes). Data that isn't needed for every ant every tick is kept in AntMeta.
+     * Maps can be at most INT16_MAX cells along each side.
+     */
     struct Ant {
         /// Current position
-        Vector2i pos{};
+        int16_t x{}, y{};
+        /// Number of ticks since this ant last did something useful (touch food, touch colony, etc).
+        /// Saturates at UINT16_MAX.
+        uint16_t ticksSinceLastUseful{};
+        /// Preferred direction for random movement, index into directions
+        uint8_t preferredDir : 3;
         /// True if the ant is holding food
-        bool holdingFood{};
-        /// Preferred direction for random movement
-        Vector2i preferredDir{};
-        /// Number of ticks since this ant last did something useful (touch food, touch colony, etc)
-        int32_t ticksSinceLastUseful{};
-        /// Set of positions we visited since the last state change
-        /// If we don't have this, ants just move back and forth
-        std::set<Vector2i> visitedPos{};
-        /// Globally unique ID for this ant
-        uint64_t id{};
+        bool holdingFood : 1;
         /// If true, this ant is dead
-        bool isDead{};
+        bool isDead : 1;
+
+        Ant() : preferredDir(0), holdingFood(false), isDead(false) {}
 
-        bool operator==(const Ant &rhs) const {
-            return id == rhs.id;
+        [[nodiscard]] inline Vector2i pos() const {
+            return {x, y};
         }
 
-        bool operator!=(const Ant &rhs) const {
-            return !(rhs == *this);
+        inline void setPos(int32_t newX, int32_t newY) {
+            x = static_cast<int16_t>(newX);
+            y = static_cast<int16_t>(newY);
         }
 
+        /// Preferred direction as a movement vector
+        [[nodiscard]] inline Vector2i direction() const {
+            return directions[preferredDir];
+        }
+
+        /// Turns the ant around, so it prefers to move the opposite way
+        inline void reverseDirection() {
+            preferredDir = 7 - preferredDir;
+        }
+
+        // for cereal (bitfields can't be archived directly)
+        friend class cereal::access;
+        template<class Archive>
+        void save(Archive & archive) const {
+            uint8_t dir = preferredDir;
+            bool food = holdingFood, dead = isDead;
+            archive(CEREAL_NVP(x), CEREAL_NVP(y), CEREAL_NVP(ticksSinceLastUseful),
+                    cereal::make_nvp("preferredDir", dir), cereal::make_nvp("holdingFood", food),
+                    cereal::make_nvp("isDead", dead));
+        }
+
+        template<class Archive>
+        void load(Archive & archive) {
+            uint8_t dir{};
+            bool food{}, dead{};
+            archive(CEREAL_NVP(x), CEREAL_NVP(y), CEREAL_NVP(ticksSinceLastUseful),
+                    cereal::make_nvp("preferredDir", dir), cereal::make_nvp("holdingFood", food),
+                    cereal::make_nvp("isDead", dead));
+            preferredDir = dir;
+            holdingFood = food;
+            isDead = dead;
+        }
+    };
+    static_assert(sizeof(Ant) == 8, "Ant should stay packed into 8 bytes");
+
+    /// Per-ant data that isn't touched by the hot part of the update loop, stored parallel to Colony::ants
+    struct AntMeta {
+        /// Globally unique ID for this ant
+        uint64_t id{};
+        /// Set of positions we visited since the last state change
+        /// If we don't have this, ants just move back and forth
+        std::set<Vector2i> visitedPos{};
+
         // for cereal
         friend class cereal::access;
         template<class Archive>
         void serialize(Archive & archive) {
-            archive(CEREAL_NVP(pos), CEREAL_NVP(holdingFood), CEREAL_NVP(preferredDir),
-                    CEREAL_NVP(ticksSinceLastUseful), CEREAL_NVP(visitedPos), CEREAL_NVP(id),
-                    CEREAL_NVP(isDead));
+            archive(CEREAL_NVP(id), CEREAL_NVP(visitedPos));
         }
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "ants/utils.h"
+
+// Native recording format (.antrec). Much smaller and cheaper to write than a PNG per tick, since
+// consecutive frames only differ where the ants moved and the pheromones changed. Use ant_export to
+// turn a recording into a PNG TAR for visualiser.py.
+//
+// Layout (all integers are little endian, "varint" is unsigned LEB128):
+//   header: "ANTREC01", u32 width, u32 height, u32 keyframe interval
+//   then one record per frame, until the end of the file:
+//     u8 flags (ANTREC_KEYFRAME, ANTREC_PALETTE_RESET)
+//     varint number of colours added to the palette, then that many RGB triples
+//     varint size of the runs, varint size compressed, then the runs compressed with zlib
+// Pixels are indices into the palette, which only grows (unless reset), so each frame only carries the
+// colours that are new. The simulator renders with a fixed palette of at most 256 colours (see
+// FramePalette), so it resets the palette and writes all of it with every keyframe, and never adds to it
+// in between. The decoder still takes up to 16 bit indices and palettes that grow between keyframes, so
+// it can read recordings made before the palette was fixed. The runs cover the frame in order, each
+// starting with a varint (length << 1 | kind): kind 0 leaves length pixels as they were in the last frame
+// (never used in keyframes), kind 1 is followed by a varint palette index to fill length pixels with.
+
+namespace ants {
+    /// The frame is a keyframe, and doesn't depend on the frames before it
+    constexpr uint8_t ANTREC_KEYFRAME = 1 << 0;
+    /// The palette is emptied before this frame's colours are added (always a keyframe)
+    constexpr uint8_t ANTREC_PALETTE_RESET = 1 << 1;
+
+    /// Turns frames of palette indices into .antrec records. Frames must be encoded in order.
+    class AntrecEncoder {
+    public:
+        /**
+         * @param keyframeInterval a keyframe is written at least every this many frames, so a recording
+         * can be cut (or skipped through) without decoding it all
+         * @param palette colours of the frames' indices (at most 256), which is written with every keyframe
+         */
+        AntrecEncoder(int32_t width, int32_t height, int32_t keyframeInterval, const std::vector<RGBColour> &palette);
+
+        /// Returns the file header
+        [[nodiscard]] std::vector<uint8_t> encodeHeader() const;
+
+        /// Encodes the next frame, of width * height palette indices
+        [[nodiscard]] std::vector<uint8_t> encodeFrame(const uint8_t *frame);
+
+    private:
+        int32_t width, height;
+        int32_t keyframeInterval;
+        /// Frames since the last keyframe, or -1 before the first frame
+        int32_t framesSinceKeyframe = -1;
+        std::vector<RGBColour> palette{};
+        /// Palette indices of the last frame
+        std::vector<uint8_t> previous{};
+    };
+
+    /// Reads frames back out of an .antrec file
+    class AntrecDecoder {
+    public:
+        /// Opens the recording and reads its header, throwing if it isn't a valid recording
+        explicit AntrecDecoder(const std::string &path);
+
+        ~AntrecDecoder();
+
+        AntrecDecoder(const AntrecDecoder &) = delete;
+        AntrecDecoder &operator=(const AntrecDecoder &) = delete;
+
+        /**
+         * Decodes the next frame
+         * @param rgb set to width * height RGB pixels
+         * @return false at the end of the recording
+         */
+        bool readFrame(std::vector<uint8_t> &rgb);
+
+        int32_t width{}, height{};
+        int32_t keyframeInterval{};
+
+    private:
+        FILE *file = nullptr;
+        /// Palette, as RGB triples
+        std::vector<uint8_t> palette{};
+        /// 16 bit, for recordings made before the palette was fixed (see the layout above)
+        std::vector<uint16_t> indices{};
+        /// Reusable buffers for a frame's runs
+        std::vector<uint8_t> compressed{}, runs{};
+    };
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mini/ini.h"
+
+// Update backends. The backend used to be picked at compile time with USE_OMP/USE_MPI in defines.h,
+// now every backend is compiled in and one is picked at runtime (antconfig.ini or the command line).
+
+namespace ants {
+    struct World;
+
+    /// A way of running the World's update: serially, with OpenMP, with MPI, etc.
+    class Backend {
+    public:
+        virtual ~Backend() = default;
+
+        /// Name of the backend, as used in antconfig.ini
+        [[nodiscard]] virtual const char *name() const = 0;
+
+        /// Called once the world has been constructed, before the first tick
+        virtual void attach(World &world) = 0;
+
+        /**
+         * Updates the world for one time step
+         * @return true if we should keep iterating the simulation, false if we should quit now
+         */
+        [[nodiscard]] virtual bool update(World &world) = 0;
+
+        /**
+         * Renders the world for recording. Called on every process when recording is enabled, since the
+         * MPI backends may need every rank to take part.
+         * @return uncompressed World::palette indices on the master, empty everywhere else
+         */
+        [[nodiscard]] virtual std::vector<uint8_t> render(const World &world);
+
+        /// True if this process should record the simulation and write out the timing report. Only false
+        /// on MPI workers.
+        [[nodiscard]] virtual bool isMaster() const {
+            return true;
+        }
+    };
+
+    /// Serial update, no threading at all
+    class SerialBackend : public Backend {
+    public:
+        [[nodiscard]] const char *name() const override {
+            return "serial";
+        }
+
+        void attach(World &world) override;
+
+        [[nodiscard]] bool update(World &world) override;
+    };
+
+    /// OpenMP update, threads are spread over the colonies and the pheromone decay
+    class OmpBackend : public Backend {
+    public:
+        [[nodiscard]] const char *name() const override {
+            return "omp";
+        }
+
+        void attach(World &world) override;
+
+        [[nodiscard]] bool update(World &world) override;
+    };
+
+    /**
+     * Creates a backend by name. Must be called before the World is constructed, because the MPI backends
+     * initialise MPI here.
+     * @param name one of "serial", "omp", "mpi", "hybrid" (MPI + OpenMP) or "domain" (MPI spatial
+     * decomposition)
+     * @param config config file, for backend specific settings
+     * @param argc pointer to main's argc, passed to MPI_Init
+     * @param argv pointer to main's argv, passed to MPI_Init
+     */
+    std::unique_ptr<Backend> createBackend(const std::string &name, mINI::INIStructure &config, int *argc,
+                                           char ***argv);
+}
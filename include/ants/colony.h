@@ -20,11 +20,19 @@ namespace ants {
         Vector2i pos{};
         /// Ants in the colony
         std::vector<Ant> ants{};
+        /// Cold data for each ant, antMeta[i] belongs to ants[i]
+        std::vector<AntMeta> antMeta{};
         /// Unique colony ID
         uint32_t id{};
         /// If true, this colony is dead
         bool isDead{};
 
+        /// Adds an ant to the colony with the given globally unique ID
+        void addAnt(const Ant &ant, uint64_t antId) {
+            ants.emplace_back(ant);
+            antMeta.emplace_back().id = antId;
+        }
+
         bool operator==(const Colony &rhs) const {
             return id == rhs.id;
         }
@@ -38,7 +46,7 @@ namespace ants {
         template<class Archive>
         void serialize(Archive & archive) {
             archive(CEREAL_NVP(hunger), CEREAL_NVP(colour), CEREAL_NVP(pos), CEREAL_NVP(ants),
-                    CEREAL_NVP(id), CEREAL_NVP(isDead));
+                    CEREAL_NVP(antMeta), CEREAL_NVP(id), CEREAL_NVP(isDead));
         }
     };
 };
\ No newline at end of file
@@ -7,12 +7,9 @@
 
 // Hardcoded configuration for the simulator
 
-/// If true, use OpenMP for acceleration.
-#define USE_OMP 1
+// The serial/OpenMP/MPI backend used to be chosen here at compile time. It is now chosen at runtime,
+// see ants/backend.h.
 
-/// If true, use MPI for acceleration.
-#define USE_MPI 0
-
-#if USE_MPI && USE_OMP
-#error "Sorry, due to time constraints, the OMP and MPI combination is not available at this time"
-#endif
+/// Side length, in cells, of the square tiles used to track which regions of the world are active.
+/// Pheromone decay, rendering and food counting skip tiles with no pheromone and no ants.
+#define ACTIVITY_TILE_SIZE 16
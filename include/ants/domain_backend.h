@@ -0,0 +1,115 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mpi.h>
+#include "ants/backend.h"
+#include "ants/utils.h"
+
+// MPI spatial domain decomposition backend, as documented in docs/parallel.md
+
+namespace ants {
+    struct Colony;
+
+    /**
+     * MPI update where each rank owns a horizontal strip of the map (a whole number of rows of activity
+     * tiles) and only updates the ants standing in it. Ants can only move one cell per tick, so each
+     * rank only needs a one row halo of its neighbours' food and pheromones. Ants that walk off the
+     * strip are handed to the neighbouring rank, along with any pheromone they left or food they took in
+     * the halo. Colony state is replicated on every rank and kept in sync with small reductions.
+     */
+    class DomainBackend : public Backend {
+    public:
+        /// Initialises MPI
+        DomainBackend(int *argc, char ***argv);
+
+        /// Finalises MPI
+        ~DomainBackend() override;
+
+        [[nodiscard]] const char *name() const override {
+            return "domain";
+        }
+
+        void attach(World &world) override;
+
+        [[nodiscard]] bool update(World &world) override;
+
+        [[nodiscard]] std::vector<uint8_t> render(const World &world) override;
+
+        [[nodiscard]] bool isMaster() const override {
+            return mpiRank == 0;
+        }
+
+    private:
+        /// Computes the rows of activity tiles [tyBegin, tyEnd) owned by the given rank
+        [[nodiscard]] std::pair<int32_t, int32_t> tileRowsOf(int32_t rank, int32_t tilesY) const;
+
+        /// Returns true if the row y is owned by this rank
+        [[nodiscard]] inline bool owns(int32_t y) const {
+            return y >= yBegin && y < yEnd;
+        }
+
+        /**
+         * A message to each neighbour and one from each, sent without blocking. Messages can be any size,
+         * so the sizes are sent first, with persistent requests set up once in attach.
+         * Index 0 is the neighbour above (lower y), index 1 the one below.
+         */
+        struct NeighbourExchange {
+            int tag{};
+            std::array<uint64_t, 2> sendSizes{}, recvSizes{};
+            /// Sends of the sizes, then receives
+            std::array<MPI_Request, 4> sizeRequests{MPI_REQUEST_NULL, MPI_REQUEST_NULL, MPI_REQUEST_NULL,
+                                                    MPI_REQUEST_NULL};
+            /// Sends of the messages, then receives
+            std::array<MPI_Request, 4> dataRequests{};
+            /// Kept here until the sends complete
+            std::array<std::string, 2> sent{};
+            /// Empty if there is no neighbour in that direction
+            std::array<std::string, 2> received{};
+        };
+
+        /// Sets up the persistent requests for an exchange with the neighbours
+        void initExchange(NeighbourExchange &exchange, int tag) const;
+
+        /// Starts sending a message to each neighbour (and receiving the sizes of theirs)
+        void startExchange(NeighbourExchange &exchange, std::string toUp, std::string toDown) const;
+
+        /// Receives the neighbours' messages into exchange.received, and waits for ours to be sent
+        void finishExchange(NeighbourExchange &exchange) const;
+
+        /**
+         * Starts sending ants that left this rank's strip to the neighbouring ranks, along with the
+         * pheromones deposited and the food taken in the halo rows
+         */
+        void sendBoundary(World &world);
+
+        /// Receives what the neighbours sent with sendBoundary, and applies it
+        void receiveBoundary(World &world);
+
+        /// Starts sending this rank's edge rows of food and pheromones to the neighbours, for their halos.
+        /// Must be called after the grids are committed.
+        void sendHalos(World &world);
+
+        /// Receives the neighbours' edge rows into the halo rows
+        void receiveHalos(World &world);
+
+        int32_t mpiWorldSize{};
+        int32_t mpiRank{};
+        /// Neighbouring ranks above (lower y) and below (higher y), or MPI_PROC_NULL at the map edges
+        int neighbourUp{}, neighbourDown{};
+        /// Rows of activity tiles owned by this rank
+        int32_t tyBegin{}, tyEnd{};
+        /// Rows of cells owned by this rank
+        int32_t yBegin{}, yEnd{};
+        /// Cells in this rank's strip where a neighbour's ant took food this tick, so the tile food
+        /// counts need updating after the commit
+        std::vector<Vector2i> foodTakenByNeighbours{};
+        NeighbourExchange boundaryExchange{}, haloExchange{};
+    };
+}
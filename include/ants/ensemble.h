@@ -0,0 +1,27 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#pragma once
+#include "mini/ini.h"
+
+// Ensemble mode: many independent simulations in one MPI job, as documented in docs/parallel.md
+
+namespace ants {
+    /**
+     * Runs an ensemble of independent simulations over MPI, for seed and parameter sweeps. Every
+     * combination of the values listed in the [Sweep] section is run once per seed, and each member of
+     * the ensemble is a whole World run by one group of [Ensemble] group_size ranks: with OpenMP inside
+     * the rank if the group is one rank, otherwise with the hybrid backend over the group. Groups take
+     * the next member as soon as they finish one, so members that exit early don't leave ranks idle.
+     * At the end, every member's summary statistics are gathered to rank 0 and written out as a CSV.
+     *
+     * This initialises and finalises MPI itself, so it is used instead of a Backend.
+     * @param config config file, which members copy and apply their sweep values to
+     * @param argc pointer to main's argc, passed to MPI_Init
+     * @param argv pointer to main's argv, passed to MPI_Init
+     * @return exit code
+     */
+    int runEnsemble(mINI::INIStructure &config, int *argc, char ***argv);
+}
@@ -0,0 +1,116 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ants/ant.h"
+#include "ants/world.h"
+
+// Event log recording format (.antlog). Instead of rendering a frame every tick, the simulation logs
+// what its ants did, which costs a few bytes per ant rather than a pass over the whole map. ant_render
+// replays the log through the same pheromone and rendering code as the simulation, so it can render
+// the frames afterwards, on any machine.
+//
+// Layout ("varint" is unsigned LEB128, f64 is a little endian IEEE double):
+//   "ANTLOG01", then blocks until the end of the file. Each block is a varint size, a varint size
+//   compressed, then the block compressed with zlib. The first block is the header, the rest are
+//   one per tick.
+//   header: varint width, height, number of colonies; f64 pheromone decay, fuzz and gain factors;
+//     varint CRC32 of random.bin's doubles; food then obstacle bitmaps (one bit per cell, row by row,
+//     low bit first); then per colony: u8 r, g, b, varint x, y, number of starting ants, f64 hunger
+//   tick: for each colony alive at the start of the tick: one byte per ant alive at the start of the
+//     tick (in order, see ANTLOG_*), then a varint number of ants spawned at the colony. Then for every
+//     colony: u8 1 if dead, f64 hunger.
+// Pheromone deposits and food pickups aren't logged, since they follow from where each ant moved and
+// whether it's holding food. The pheromone decay fuzz comes from random.bin, which ant_render loads
+// just like the simulator (the CRC32 checks it's the same file).
+
+namespace ants {
+    /// Low 4 bits of an ant's event byte: index into directions of the way it moved, or this if it didn't
+    constexpr uint8_t ANTLOG_STAYED = 8;
+    /// The ant picked up food (from the cell it's on), or dropped it off at the colony
+    constexpr uint8_t ANTLOG_TOGGLED_FOOD = 1 << 4;
+    /// The ant died
+    constexpr uint8_t ANTLOG_DIED = 1 << 5;
+
+    /// Compresses a header or tick block, and puts its sizes in front, ready to write to the log
+    [[nodiscard]] std::vector<uint8_t> compressLogBlock(const std::vector<uint8_t> &block);
+
+    /**
+     * Logs the simulation's events tick by tick, by comparing the ants with their state the tick
+     * before. The log follows ants by their index in their colony, so it only works with the serial
+     * and OpenMP backends (the MPI backends move ants between ranks).
+     */
+    class EventLogger {
+    public:
+        /// Takes the world's starting state, which must be before the first tick
+        explicit EventLogger(const World &world);
+
+        /// Returns the magic and the (compressed) header block
+        [[nodiscard]] std::vector<uint8_t> encodeHeader() const;
+
+        /// Returns the uncompressed block for the tick that was just simulated
+        [[nodiscard]] std::vector<uint8_t> logTick();
+
+    private:
+        const World &world;
+        /// Each colony's ants as of the last tick logged
+        std::vector<std::vector<Ant>> lastAnts{};
+        /// Whether each colony was dead as of the last tick logged
+        std::vector<uint8_t> lastDead{};
+    };
+
+    /// Replays an .antlog file into a world, one tick at a time, so it can be rendered
+    class EventReplay {
+    public:
+        /// Opens the log and sets up the world from its header, throwing if it isn't a valid log
+        explicit EventReplay(const std::string &path);
+
+        EventReplay(const EventReplay &) = delete;
+        EventReplay &operator=(const EventReplay &) = delete;
+
+        /**
+         * Applies the next tick's events, and decays the pheromones the same way as the simulation
+         * @return false at the end of the log
+         */
+        bool nextTick();
+
+        /// Renders the rows [yBegin, yEnd) of the world (as palette indices), as it is after the last tick
+        /// replayed. Thread safe.
+        [[nodiscard]] std::vector<uint8_t> renderRows(int32_t yBegin, int32_t yEnd) const;
+
+        /// Palette that the world is rendered with
+        [[nodiscard]] const std::vector<RGBColour> &palette() const {
+            return world.palette.colours();
+        }
+
+        [[nodiscard]] int32_t width() const {
+            return world.width;
+        }
+
+        [[nodiscard]] int32_t height() const {
+            return world.height;
+        }
+
+        /// If true, the pheromone decay and rendering use OpenMP threads
+        void setThreaded(bool threaded) {
+            world.threaded = threaded;
+        }
+
+    private:
+        /// Reads and decompresses the next block. Returns false at the end of the file.
+        bool readBlock(std::vector<uint8_t> &block);
+
+        /// Closed however the replay ends, including when the constructor throws on a corrupt header
+        std::unique_ptr<FILE, decltype(&fclose)> file{nullptr, fclose};
+        World world{};
+        /// Reusable buffers for a block
+        std::vector<uint8_t> compressed{}, block{};
+    };
+}
@@ -0,0 +1,107 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "microtar/microtar.h"
+
+// Buffered asynchronous file output for recordings. On parallel filesystems like Lustre, lots of small
+// synchronous writes (which is what microtar does through a FILE *) are very slow, so instead everything is
+// copied into a few big buffers, and each one is written out in one go while the next is filled.
+
+namespace ants {
+    /// Size of each of AsyncFileWriter's buffers
+    constexpr size_t WRITE_BUFFER_BYTES = 8 * 1024 * 1024;
+    /// Number of buffers, so up to this many minus one can be in flight while the next is filled
+    constexpr size_t WRITE_BUFFERS = 4;
+    /// Alignment of the buffers (one page)
+    constexpr size_t WRITE_BUFFER_ALIGNMENT = 4096;
+
+    /**
+     * Writes a file sequentially through a few big page aligned buffers. Full buffers are submitted to the
+     * kernel with io_uring (set up with raw syscalls, no liburing) and written in the background, so write()
+     * only waits when every buffer is still in flight. If io_uring isn't available (old kernels, or blocked by
+     * a seccomp policy in a container), each full buffer is written with one pwrite() instead.
+     *
+     * Not thread safe: one thread at a time must do all the writing.
+     */
+    class AsyncFileWriter {
+    public:
+        /// Creates (or truncates) the file. Check isOpen() to see if that worked.
+        explicit AsyncFileWriter(const std::string &path);
+
+        /// Closes the file, if close() wasn't already called
+        ~AsyncFileWriter();
+
+        AsyncFileWriter(const AsyncFileWriter &) = delete;
+        AsyncFileWriter &operator=(const AsyncFileWriter &) = delete;
+
+        [[nodiscard]] bool isOpen() const {
+            return fd != -1;
+        }
+
+        /// Appends the data to the file. Returns false if an earlier write failed.
+        bool write(const void *data, size_t len);
+
+        /// Writes out the last buffer, waits for every write to finish and closes the file. Returns false if
+        /// any write failed.
+        bool close();
+
+    private:
+        struct Buffer {
+            uint8_t *data = nullptr;
+            /// Bytes filled
+            size_t used{};
+            /// Offset in the file it's written at
+            uint64_t offset{};
+            bool inFlight = false;
+        };
+
+        /// Starts writing out the current buffer, and moves on to a free one (waiting for one if they're all in
+        /// flight)
+        void submitCurrent();
+
+        /// Writes the rest of the buffer from done bytes on with pwrite(), and marks it free
+        void finishWithPwrite(Buffer &buffer, size_t done);
+
+        /// Sets up the io_uring, returning false if it's not available
+        bool setupRing();
+
+        /// Unmaps and closes the io_uring, if there is one
+        void teardownRing();
+
+        /// Waits for one write submitted to the io_uring to complete, and handles it
+        void waitForCompletion();
+
+        std::string path{};
+        int fd = -1;
+        std::vector<Buffer> buffers{};
+        /// Buffer being filled
+        size_t current{};
+        /// Offset in the file of the next buffer
+        uint64_t nextOffset{};
+        size_t numInFlight{};
+        bool failed = false;
+
+        /// io_uring file descriptor and mappings, or -1 if writing with pwrite()
+        int ringFd = -1;
+        /// Set if a write through the io_uring failed, after which everything is written with pwrite()
+        bool ringBroken = false;
+        void *sqRing = nullptr, *cqRing = nullptr, *sqes = nullptr;
+        size_t sqRingBytes{}, cqRingBytes{}, sqesBytes{};
+        unsigned *sqTail = nullptr, *sqMask = nullptr, *sqArray = nullptr;
+        unsigned *cqHead = nullptr, *cqTail = nullptr, *cqMask = nullptr;
+        void *cqes = nullptr;
+    };
+
+    /**
+     * Opens a TAR for writing like mtar_open(tar, path, "w"), but with an AsyncFileWriter underneath
+     * @return a microtar error code
+     */
+    int mtarOpenAsync(mtar_t *tar, const std::string &path);
+}
@@ -0,0 +1,210 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <sys/mman.h>
+#include "log/log.h"
+#include "ants/defines.h"
+
+// Aligned, NUMA-aware storage for SnapGrid buffers.
+//
+// The grids used to be allocated with new T[n]{}, which zeroes the whole array on the main thread.
+// Because Linux places pages on the NUMA node of the thread that first touches them, this put the
+// entire grid on socket 0. GridBuffer instead leaves the pages untouched until they are zeroed in
+// parallel, with the same static row partitioning as World::decayAndCommitPheromones, so that each thread's
+// rows end up on its own socket.
+
+namespace ants {
+    /// Alignment of grid buffers when huge pages are not in use (one cache line)
+    constexpr size_t GRID_ALIGNMENT = 64;
+    /// Size of a huge page on x86-64
+    constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    /// How a grid buffer should be backed by huge pages
+    enum class HugePageMode {
+        /// Regular 4 KiB pages
+        NONE,
+        /// Transparent huge pages, requested with madvise(MADV_HUGEPAGE)
+        TRANSPARENT,
+        /// Explicit huge pages from the hugetlbfs pool (MAP_HUGETLB), falls back to transparent
+        EXPLICIT,
+    };
+
+    /// Parses the "huge_pages" config value. An empty string means HugePageMode::NONE.
+    inline HugePageMode parseHugePageMode(const std::string &str) {
+        if (str.empty() || str == "none") {
+            return HugePageMode::NONE;
+        } else if (str == "transparent") {
+            return HugePageMode::TRANSPARENT;
+        } else if (str == "explicit") {
+            return HugePageMode::EXPLICIT;
+        }
+        throw std::invalid_argument("Invalid huge_pages value '" + str + "' (expected none, transparent or explicit)");
+    }
+
+    /**
+     * RAII owned, zero initialised buffer for a 2D or 3D grid laid out as x + width * y + width * height * z.
+     * Move-only. Can also wrap memory owned by someone else, such as an MPI shared memory window.
+     */
+    template<typename T>
+    class GridBuffer {
+        static_assert(std::is_trivially_copyable_v<T>, "GridBuffer elements are zeroed with memset");
+
+    public:
+        GridBuffer() = default;
+
+        /**
+         * Allocates and zeroes a new buffer
+         * @param width size of the x dimension
+         * @param height size of the y dimension, this is the dimension split between threads
+         * @param depth size of the z dimension (1 for 2D grids)
+         * @param mode huge page backing to request
+         */
+        GridBuffer(int32_t width, int32_t height, int32_t depth, HugePageMode mode) {
+            count = static_cast<size_t>(width) * height * depth;
+            if (count == 0) {
+                return;
+            }
+            allocate(mode);
+            firstTouch(width, height, depth);
+        }
+
+        /**
+         * Wraps existing memory, which is not zeroed or freed by this buffer
+         * @param memory start of the elements, must stay valid for as long as this buffer is used
+         * @param count number of elements
+         */
+        GridBuffer(T *memory, size_t count) : data(memory), count(count), owned(false) {}
+
+        GridBuffer(const GridBuffer &) = delete;
+
+        GridBuffer &operator=(const GridBuffer &) = delete;
+
+        GridBuffer(GridBuffer &&other) noexcept {
+            *this = std::move(other);
+        }
+
+        GridBuffer &operator=(GridBuffer &&other) noexcept {
+            if (this != &other) {
+                release();
+                data = std::exchange(other.data, nullptr);
+                count = std::exchange(other.count, 0);
+                mappedBytes = std::exchange(other.mappedBytes, 0);
+                owned = std::exchange(other.owned, true);
+            }
+            return *this;
+        }
+
+        ~GridBuffer() {
+            release();
+        }
+
+        inline T &operator[](size_t i) {
+            return data[i];
+        }
+
+        inline const T &operator[](size_t i) const {
+            return data[i];
+        }
+
+        [[nodiscard]] inline T *get() const {
+            return data;
+        }
+
+        /// Number of elements in the buffer
+        [[nodiscard]] inline size_t size() const {
+            return count;
+        }
+
+        /// Number of bytes of element data in the buffer
+        [[nodiscard]] inline size_t bytes() const {
+            return count * sizeof(T);
+        }
+
+    private:
+        static size_t roundUp(size_t n, size_t multiple) {
+            return ((n + multiple - 1) / multiple) * multiple;
+        }
+
+        void allocate(HugePageMode mode) {
+            if (mode == HugePageMode::EXPLICIT) {
+                auto len = roundUp(bytes(), HUGE_PAGE_SIZE);
+                void *ptr = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (ptr != MAP_FAILED) {
+                    data = static_cast<T *>(ptr);
+                    mappedBytes = len;
+                    return;
+                }
+                log_warn("Failed to map %zu bytes of explicit huge pages (%s), falling back to transparent",
+                         len, strerror(errno));
+                mode = HugePageMode::TRANSPARENT;
+            }
+
+            auto alignment = mode == HugePageMode::TRANSPARENT ? HUGE_PAGE_SIZE : GRID_ALIGNMENT;
+            auto len = roundUp(bytes(), alignment);
+            void *ptr = nullptr;
+            if (posix_memalign(&ptr, alignment, len) != 0) {
+                throw std::bad_alloc();
+            }
+            if (mode == HugePageMode::TRANSPARENT && madvise(ptr, len, MADV_HUGEPAGE) != 0) {
+                log_warn("madvise(MADV_HUGEPAGE) failed: %s", strerror(errno));
+            }
+            data = static_cast<T *>(ptr);
+        }
+
+        /// Zeroes the buffer, partitioned by tile rows the same way as the pheromone decay loop
+        void firstTouch(int32_t width, int32_t height, int32_t depth) {
+            auto rowBytes = static_cast<size_t>(width) * sizeof(T);
+            auto sliceSize = static_cast<size_t>(width) * height;
+            auto *ptr = data;
+            // the decay loop hands out whole rows of activity tiles to each thread
+            int32_t tileRows = (height + ACTIVITY_TILE_SIZE - 1) / ACTIVITY_TILE_SIZE;
+#pragma omp parallel for default(none) firstprivate(ptr, rowBytes, sliceSize, width, height, depth, tileRows) \
+    schedule(static)
+            for (int32_t ty = 0; ty < tileRows; ty++) {
+                for (int32_t y = ty * ACTIVITY_TILE_SIZE; y < std::min(height, (ty + 1) * ACTIVITY_TILE_SIZE); y++) {
+                    for (int32_t z = 0; z < depth; z++) {
+                        memset(static_cast<void *>(ptr + static_cast<size_t>(width) * y + sliceSize * z), 0, rowBytes);
+                    }
+                }
+            }
+        }
+
+        void release() {
+            if (data == nullptr) {
+                return;
+            }
+            if (!owned) {
+                // not ours to free
+            } else if (mappedBytes != 0) {
+                munmap(data, mappedBytes);
+            } else {
+                free(data);
+            }
+            data = nullptr;
+            count = 0;
+            mappedBytes = 0;
+            owned = true;
+        }
+
+        T *data{};
+        size_t count{};
+        /// Non-zero if the buffer was allocated with mmap (explicit huge pages)
+        size_t mappedBytes{};
+        /// False if the memory is owned by someone else
+        bool owned = true;
+    };
+}
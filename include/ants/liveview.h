@@ -0,0 +1,73 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ants/utils.h"
+
+// Live view: the latest rendered frames are published to a ring of slots in POSIX shared memory
+// (/dev/shm/<name>), which a viewer on the same machine (scripts/live_viewer.py) maps and displays while
+// the simulation runs. Publishing a frame is one memcpy into the mapping, so the simulation never waits on
+// the viewer, and nothing is written to disk.
+//
+// Layout (integers are in native byte order, offsets are in bytes):
+//   0: "ANTLIVE1", 8: u32 width, 12: u32 height, 16: u32 number of slots, 20: u32 number of palette
+//   colours, 24: u64 offset of the first slot, 32: u64 bytes per slot
+//   64: u64 latest, the number of frames published so far (the newest is in slot (latest - 1) % slots)
+//   72: u64 finished, set to 1 once the simulation is done and no more frames will be published
+//   128: the palette, as RGB triples
+//   each slot: u64 sequence, i64 tick, then at offset 64 the frame's width * height palette indices
+// A slot's sequence is its frame's number plus one while it holds that whole frame, and 0 while it's being
+// overwritten. A reader checks that the sequence is the frame it wants both before and after reading the
+// pixels; if it changed in between, the writer lapped the reader and the frame should be skipped. Readers
+// never write to the mapping.
+
+namespace ants {
+    /// Offsets in the live view's header
+    constexpr size_t LIVEVIEW_LATEST_OFFSET = 64;
+    constexpr size_t LIVEVIEW_FINISHED_OFFSET = 72;
+    constexpr size_t LIVEVIEW_PALETTE_OFFSET = 128;
+    /// Offset of the pixels in each slot
+    constexpr size_t LIVEVIEW_PIXELS_OFFSET = 64;
+
+    /// Publishes frames of palette indices to a shared memory ring for a live viewer. Only one thread may
+    /// publish.
+    class LiveFrameRing {
+    public:
+        /**
+         * Creates the shared memory, replacing any left behind by an earlier run with the same name.
+         * Check isOpen() to see if that worked.
+         * @param name shared memory name, e.g. /ant_colony_live
+         * @param numSlots number of frames kept, so a viewer has numSlots - 1 frames' time to read one before
+         * it's overwritten
+         */
+        LiveFrameRing(const std::string &name, int32_t width, int32_t height, int32_t numSlots,
+                      const std::vector<RGBColour> &palette);
+
+        /// Marks the ring finished, then unmaps and unlinks it (viewers that have it mapped keep the last frames)
+        ~LiveFrameRing();
+
+        LiveFrameRing(const LiveFrameRing &) = delete;
+        LiveFrameRing &operator=(const LiveFrameRing &) = delete;
+
+        [[nodiscard]] bool isOpen() const {
+            return mapping != nullptr;
+        }
+
+        /// Copies the frame (width * height palette indices) rendered for the tick into the next slot
+        void publish(int64_t tick, const std::vector<uint8_t> &frame);
+
+    private:
+        std::string name{};
+        int32_t width, height, numSlots;
+        uint8_t *mapping = nullptr;
+        size_t mappingBytes{}, slotsOffset{}, slotBytes{};
+        /// Number of frames published so far
+        uint64_t numPublished{};
+    };
+}
@@ -0,0 +1,196 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <mpi.h>
+#include "ants/backend.h"
+#include "mini/ini.h"
+
+// MPI update backend, as documented in docs/parallel.md
+
+namespace ants {
+    typedef enum {
+        /// Tag to indicate this message is the colonies a worker updated
+        TAG_COLONY_DATA = 0,
+        /// Tag to indicate this message holds ants and halo writes crossing a strip boundary (domain backend)
+        TAG_DOMAIN_BOUNDARY,
+        /// Tag to indicate this message holds a strip's edge row, for the neighbour's halo (domain backend)
+        TAG_DOMAIN_HALO,
+    } MPITag_t;
+
+    /**
+     * Initialises MPI, checking for thread support if needed. Shared by all the MPI backends.
+     * @param threaded if true, OpenMP threads are used inside each rank (only the main thread calls MPI)
+     */
+    void initialiseMpi(int *argc, char ***argv, bool threaded);
+
+    /**
+     * MPI update: every rank holds the whole world and updates a share of the ants. The ranks on each
+     * node share one copy of the grids, in an MPI shared memory window, which they write into directly
+     * like OpenMP threads. The node leaders combine their nodes' changes to the grids with a reduction.
+     * Then every rank does the same colony bookkeeping, and the ranks of each node decay a share of the
+     * node's grids, so every node ends the tick with the same world without going through the master.
+     * The master only collects the ants, for rendering.
+     *
+     * Each rank is given a contiguous run of ants, in colony order, with an even share of the live ants.
+     * A run can start and end part way through a colony, so any number of colonies works with any number
+     * of ranks. As ants die and are born, the runs are rebalanced every mpi_rebalance_interval ticks.
+     *
+     * In hybrid mode, each rank additionally uses OpenMP threads to update its colonies and to decay
+     * the grid. This is intended to be run with one rank per node (or socket), so that the number of
+     * ranks taking part in the reductions scales with the number of nodes, not the number of cores.
+     */
+    class MpiBackend : public Backend {
+    public:
+        /**
+         * Initialises MPI
+         * @param hybrid if true, also use OpenMP threads inside each rank
+         * @param config config file, for the rebalance interval
+         */
+        MpiBackend(int *argc, char ***argv, bool hybrid, mINI::INIStructure &config);
+
+        /**
+         * Runs over the ranks of comm, with MPI already initialised by the caller (used by the ensemble,
+         * where each group of ranks runs its own world)
+         * @param comm ranks taking part, which must stay valid for the backend's lifetime
+         * @param hybrid if true, also use OpenMP threads inside each rank
+         * @param config config file, for the rebalance interval
+         */
+        MpiBackend(MPI_Comm comm, bool hybrid, mINI::INIStructure &config);
+
+        /// Finalises MPI, if it was initialised by this backend
+        ~MpiBackend() override;
+
+        [[nodiscard]] const char *name() const override {
+            return hybrid ? "hybrid" : "mpi";
+        }
+
+        void attach(World &world) override;
+
+        [[nodiscard]] bool update(World &world) override;
+
+        [[nodiscard]] bool isMaster() const override {
+            return mpiRank == 0;
+        }
+
+    private:
+        /// Reads the config and sets up the ant datatype, once MPI is initialised
+        void setup(mINI::INIStructure &config);
+
+        /// Position of an ant: its colony, and its index in that colony's ants. Ordered colony first.
+        struct AntIndex {
+            int32_t colony{};
+            int32_t ant{};
+
+            bool operator<(const AntIndex &rhs) const {
+                return colony < rhs.colony || (colony == rhs.colony && ant < rhs.ant);
+            }
+
+            bool operator==(const AntIndex &rhs) const {
+                return colony == rhs.colony && ant == rhs.ant;
+            }
+        };
+
+        /// The ants [begin, end) of one colony
+        struct AntRange {
+            int32_t colony{};
+            int32_t begin{};
+            int32_t end{};
+        };
+
+        /**
+         * Updates this rank's ants
+         * @param colonyReturns for each colony, incremented each time one of its ants returns home with food
+         * @param seed seed to initialise each thread's pcg32_fast rng with
+         */
+        void updateAnts(World &world, std::vector<int32_t> &colonyReturns, uint64_t seed) const;
+
+        /**
+         * Calls fn with each colony's part of the given rank's ants, in order. Ants spawned since the
+         * partition was made belong to whoever owns the end of their colony.
+         */
+        template<typename F>
+        static void forEachRange(const World &world, const std::vector<AntIndex> &parts, int32_t rank, F &&fn);
+
+        /// Returns the rank owning the given ant
+        [[nodiscard]] static int32_t ownerOf(const std::vector<AntIndex> &parts, AntIndex index);
+
+        /**
+         * Moves the grids (and the activity tile tables that go with them) into a shared memory window
+         * for each node, and sets up the node and node leader communicators
+         */
+        void shareGrids(World &world);
+
+        /// Waits for every rank on the node, and makes their writes to the shared grids visible
+        void syncNode() const;
+
+        /// Rows of activity tiles [tyBegin, tyEnd) this rank commits and decays for its node
+        [[nodiscard]] std::pair<int32_t, int32_t> nodeTileRows(int32_t tilesY) const;
+
+        /// Splits the ants into one run per rank, each with the same number of live ants (as seen by this rank)
+        [[nodiscard]] std::vector<AntIndex> balancedPartition(const World &world) const;
+
+        /// Switches to nextPartition, moving ants that changed rank to their new owner
+        void rebalance(World &world);
+
+        /**
+         * Sends the ants this rank owned under the old partition but not the current one to their new
+         * owners, with their AntMeta, and receives the ants this rank now owns
+         */
+        void migrateAnts(World &world, const std::vector<AntIndex> &oldPartition) const;
+
+        /**
+         * Builds a datatype covering the ants the given rank updates, in place, so they can be sent or
+         * received without packing. Must be freed with MPI_Type_free.
+         */
+        [[nodiscard]] MPI_Datatype antsDatatype(World &world, int32_t rank) const;
+
+        /// Starts sending each worker's ants to the master, which receives them straight into its world for
+        /// rendering
+        void startGatherAnts(World &world);
+
+        /// Waits for startGatherAnts to finish. Must be called before any colony's ants array is resized.
+        void finishGatherAnts();
+
+        /**
+         * Combines the food taken and pheromone deposited by every node this tick into the dirty grids of
+         * every node. Each node leader gathers the cells its node changed, the union of the changed cells
+         * is gathered by every leader, then the deltas for those cells are summed with one MPI_Allreduce.
+         */
+        void reduceGridDeltas(World &world) const;
+
+        /// true if OpenMP threads are used inside each rank
+        bool hybrid = false;
+        /// true if MPI was initialised by this backend, so must be finalised by it too
+        bool ownsMpi = false;
+        /// the ranks running this world: MPI_COMM_WORLD, or an ensemble group
+        MPI_Comm comm = MPI_COMM_WORLD;
+        int32_t mpiWorldSize{};
+        int32_t mpiRank{};
+        /// ranks on the same node as this one
+        MPI_Comm nodeComm = MPI_COMM_NULL;
+        int32_t nodeRank{}, nodeSize{};
+        /// the leader (node rank 0) of each node, MPI_COMM_NULL on the other ranks
+        MPI_Comm leaderComm = MPI_COMM_NULL;
+        /// shared memory window holding this node's grids
+        MPI_Win gridWindow = MPI_WIN_NULL;
+        /// rank r updates the ants from partition[r] up to (not including) partition[r + 1]
+        std::vector<AntIndex> partition{};
+        /// partition to switch to at the start of the next tick, while partitionRequest is active
+        std::vector<AntIndex> nextPartition{};
+        MPI_Request partitionRequest = MPI_REQUEST_NULL;
+        /// the ant transfers started by startGatherAnts
+        std::vector<MPI_Request> gatherRequests{};
+        /// number of ticks between rebalancing the ants over the ranks, 0 to never rebalance
+        int32_t rebalanceInterval{};
+        int32_t ticksSinceRebalance{};
+        /// MPI datatype for one Ant record
+        MPI_Datatype mpiAntType{};
+    };
+}
@@ -0,0 +1,84 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "ants/utils.h"
+
+// 8 bit palette that frames are rendered with, so a frame is one byte per pixel instead of three
+
+namespace ants {
+    /// Most colours an 8 bit palette can hold
+    constexpr int32_t PALETTE_SIZE = 256;
+    /// Most hunger shades each colony's square gets
+    constexpr int32_t PALETTE_MAX_SHADES = 16;
+    /// Levels per channel of the colour cube that colony colours are rounded to, when there are too many
+    /// colonies to give them their own entries
+    constexpr int32_t PALETTE_CUBE_LEVELS = 5;
+
+    /**
+     * Palette for one recording, built from the world's colonies. The pheromones get as many levels of the
+     * inferno colour map as fit (at least 129), after food, obstacles and the colonies. Each colony gets
+     * its own colour, plus a few shades of it for its square (which darkens as it gets hungrier). On maps
+     * with too many colonies for that (more than 41), colony colours are rounded to a 5x5x5 colour cube
+     * instead.
+     */
+    class FramePalette {
+    public:
+        FramePalette() = default;
+
+        /// Builds the palette for colonies of these colours, in order of colony ID
+        explicit FramePalette(const std::vector<RGBColour> &colonyColours);
+
+        /// Index for a pheromone strength between 0.0 and 1.0. The inferno colours are precomputed in the
+        /// palette, so this is just a multiply and round (adding 0.5 rather than calling lround, so the
+        /// renderer's loops can vectorise it).
+        [[nodiscard]] inline uint8_t pheromone(double strength) const {
+            auto level = static_cast<int32_t>(std::clamp(strength, 0.0, 1.0) * (infernoLevels - 1) + 0.5);
+            return static_cast<uint8_t>(infernoBase + level);
+        }
+
+        [[nodiscard]] inline uint8_t food() const {
+            return FOOD;
+        }
+
+        [[nodiscard]] inline uint8_t obstacle() const {
+            return OBSTACLE;
+        }
+
+        /// Index for an ant of the colony
+        [[nodiscard]] inline uint8_t ant(uint32_t colony) const {
+            return antIndices[colony];
+        }
+
+        /// Index for the colony's square, which is its colour scaled by its hunger
+        [[nodiscard]] uint8_t colony(uint32_t colony, double hunger) const;
+
+        /// The palette's colours, by index
+        [[nodiscard]] const std::vector<RGBColour> &colours() const {
+            return entries;
+        }
+
+    private:
+        static constexpr uint8_t FOOD = 0;
+        static constexpr uint8_t OBSTACLE = 1;
+        /// First index of the colonies' entries
+        static constexpr int32_t COLONY_BASE = 2;
+
+        /// Index of the entry in the colour cube closest to the colour
+        [[nodiscard]] uint8_t cubeIndex(RGBColour colour) const;
+
+        std::vector<RGBColour> entries{};
+        std::vector<RGBColour> colonyColours{};
+        /// Index of each colony's ant colour
+        std::vector<uint8_t> antIndices{};
+        /// Shades per colony after its ant colour, or 0 if colony colours are rounded to the colour cube
+        int32_t shades{};
+        int32_t infernoBase{}, infernoLevels{};
+    };
+}
@@ -18,5 +18,11 @@ namespace ants {
         PheromoneStrength() = default;
 
         PheromoneStrength(double toColony, double toFood) : toColony(toColony), toFood(toFood) {}
+
+        // for cereal
+        template<class Archive>
+        void serialize(Archive & archive) {
+            archive(toColony, toFood);
+        }
     };
 };
\ No newline at end of file
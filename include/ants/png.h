@@ -0,0 +1,45 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "ants/utils.h"
+
+// PNG encoder that can compress a frame as several strips of rows in parallel, using zlib
+
+namespace ants {
+    /// A strip of rows of a PNG, filtered and deflated on its own
+    struct PngStrip {
+        /// Raw deflate data, ending on a byte boundary so the strips can be joined together
+        std::vector<uint8_t> deflated{};
+        /// Adler-32 checksum and length of the filtered rows, before compression
+        uint32_t adler{};
+        uint64_t length{};
+    };
+
+    /**
+     * Filters and compresses the rows [yBegin, yEnd) of an 8 bit per channel image. Strips are independent
+     * (each row is filtered against the raw row above it, which is in the image whatever strip it's in),
+     * so they can be compressed on different threads, then joined with assemblePng.
+     * @param pixels the whole image, rows packed one after the other
+     * @param width width of the image in pixels
+     * @param channels bytes per pixel
+     * @param last true if this strip holds the last row of the image, which ends the deflate stream
+     * @param indexed true if the image is palette indices, whose rows are left unfiltered (the filters
+     * predict values, which means nothing for indices, so the PNG spec recommends filter None for them)
+     */
+    [[nodiscard]] PngStrip deflatePngStrip(const uint8_t *pixels, int32_t width, int32_t channels, int32_t yBegin,
+                                           int32_t yEnd, bool last, bool indexed = false);
+
+    /**
+     * Joins the strips of an image (in order, covering every row) into a PNG file
+     * @param channels bytes per pixel: 1 (greyscale, or palette indices), 3 (RGB) or 4 (RGBA)
+     * @param palette if not empty, the image is palette indices (channels must be 1) into these colours
+     */
+    [[nodiscard]] std::vector<uint8_t> assemblePng(int32_t width, int32_t height, int32_t channels,
+                                                   const std::vector<PngStrip> &strips,
+                                                   const std::vector<RGBColour> &palette = {});
+}
@@ -0,0 +1,185 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "ants/png.h"
+#include "ants/antrec.h"
+#include "ants/eventlog.h"
+#include "ants/filewriter.h"
+#include "ants/utils.h"
+#include "ants/world.h"
+#include "mini/ini.h"
+
+// Streaming PNG TAR recording pipeline
+
+namespace ants {
+    /// How recorded frames are stored
+    enum class RecordingFormat {
+        /// One PNG per frame in the TAR
+        PNG,
+        /// One .antrec file next to the TAR (see antrec.h), which ant_export turns into PNGs
+        NATIVE,
+        /// One .antlog file next to the TAR (see eventlog.h) of what the ants did each tick, with no frames
+        /// rendered at all. ant_render renders it afterwards.
+        EVENTS,
+    };
+
+    /// Recording settings, from the [Simulation] section of the config file
+    struct RecordingSettings {
+        /// Reads the settings, using the defaults for any that are missing
+        explicit RecordingSettings(mINI::INIStructure &config);
+
+        RecordingFormat format = RecordingFormat::PNG;
+        /// Number of threads encoding frames (the native format always uses one)
+        int32_t numThreads = 2;
+        /// Bytes of queued frames (raw or encoded) after which Recorder::push() blocks. At least one frame
+        /// is always let through, however big.
+        size_t memoryCap = 1024 * BYTES2MIB;
+        /// PNG frames are split into strips of about this many bytes, compressed in parallel
+        size_t stripBytes = 4 * BYTES2MIB;
+        /// Native format: a keyframe is written at least every this many frames
+        int32_t keyframeInterval = 100;
+        /// A frame is rendered every this many ticks, starting at firstTick
+        int32_t stride = 1;
+        /// First and last ticks (counting from 0) that frames are rendered for
+        int64_t firstTick = 0, lastTick = INT64_MAX;
+        /// Part of the world that frames show, see World::setFrameRegion (the default is the whole world)
+        FrameRegion region{};
+        /// Shared memory name the frames are also published to for a live viewer (see liveview.h), or empty
+        /// for no live view
+        std::string liveViewName{};
+        /// Number of frames the live view keeps
+        int32_t liveViewSlots = 4;
+
+        /// Returns true if a frame is rendered for the tick (counting from 0). Ticks that aren't recorded
+        /// aren't rendered at all.
+        [[nodiscard]] inline bool recordsTick(int64_t tick) const {
+            return tick >= firstTick && tick <= lastTick && (tick - firstTick) % stride == 0;
+        }
+    };
+
+    /**
+     * Records frames to the world's PNG TAR while the simulation runs. Frames are queued (as palette
+     * indices, one byte per pixel), encoded as indexed colour PNGs by a pool of threads, then written to
+     * the TAR in order by one more thread. The frames waiting to be encoded or written are kept under a
+     * fixed amount of memory: pushing a frame blocks while it's full, so memory use no longer grows with
+     * the number of ticks.
+     *
+     * Big frames are split into strips of rows, which are compressed by different threads and then
+     * joined into one PNG, so a frame doesn't take one thread however big it is.
+     *
+     * In the native format, each frame is stored as the difference from the one before, so there is
+     * only one encoder thread, and frames go to an .antrec file instead of the TAR. In the events format,
+     * the "frames" are the event log's tick blocks, which are compressed and written to an .antlog file.
+     */
+    class Recorder {
+    public:
+        /**
+         * Starts the encoder and writer threads
+         * @param world world to record, which must already be set up for recording (including its
+         * frame region)
+         */
+        Recorder(World &world, const RecordingSettings &settings);
+
+        /// Finishes the recording, if finish() wasn't already called
+        ~Recorder();
+
+        Recorder(const Recorder &) = delete;
+        Recorder &operator=(const Recorder &) = delete;
+
+        /**
+         * Queues an uncompressed frame of World::palette indices for encoding, blocking while the queue is full
+         * @param tick tick (counting from 0) the frame was rendered for
+         */
+        void push(std::vector<uint8_t> frame, int64_t tick);
+
+        /// Events format only: logs the tick that was just simulated, instead of pushing a frame
+        void logEvents();
+
+        /// Waits for every queued frame to be written, then stops the threads. In the PNG and native formats,
+        /// also writes frame_ticks.csv to the TAR, giving the tick of each frame (which is no longer the
+        /// frame's number once recording_stride or recording_first_tick are set).
+        void finish();
+
+        /// Most bytes of frames that were queued at once
+        [[nodiscard]] size_t peakBytes() const {
+            return peakBytesQueued;
+        }
+
+        /// Number of frames pushed so far
+        [[nodiscard]] size_t numFrames() const {
+            return nextFrame;
+        }
+
+    private:
+        /// A frame being encoded
+        struct FrameJob {
+            size_t index{};
+            std::vector<uint8_t> pixels{};
+            std::vector<PngStrip> strips{};
+            /// Number of strips not compressed yet
+            size_t stripsLeft{};
+        };
+
+        /// Encoder threads: compresses strips until finish() is called and none are left, and joins up the
+        /// strips of each frame into a PNG once they're all done
+        void encodeLoop();
+
+        /// Writer thread: writes encoded frames to the TAR (or the stream file) in order, until the encoders are
+        /// done
+        void writeLoop();
+
+        World &world;
+        RecordingSettings settings;
+        /// Size of the frames in pixels, from the world's frame region
+        int32_t frameWidth{}, frameHeight{};
+        /// Native format only: the encoder
+        std::unique_ptr<AntrecEncoder> antrecEncoder{};
+        /// Events format only: the logger
+        std::unique_ptr<EventLogger> eventLogger{};
+        /// Native and events formats: the file frames are written to (nullptr if it couldn't be opened)
+        std::unique_ptr<AsyncFileWriter> streamFile{};
+
+        std::mutex mutex{};
+        /// Signalled when strips are queued, or finish() is called
+        std::condition_variable stripQueued{};
+        /// Signalled when a frame is encoded, or the encoders are done
+        std::condition_variable frameEncoded{};
+        /// Signalled when queued bytes are freed
+        std::condition_variable spaceFreed{};
+
+        /// Strips waiting to be compressed: their frame, and their number in it
+        std::deque<std::pair<std::shared_ptr<FrameJob>, size_t>> rawStrips{};
+        /// Encoded frames waiting for the frames before them to be written, by frame number
+        std::map<size_t, std::vector<uint8_t>> encodedFrames{};
+        /// Number given to the next frame pushed
+        size_t nextFrame{};
+        /// Tick of each frame pushed, by frame number
+        std::vector<int64_t> frameTicks{};
+        /// Number of the next frame to write
+        size_t nextToWrite{};
+        /// Bytes held by frames waiting for or being encoded, and encoded frames waiting for or being written
+        size_t bytesQueued{};
+        size_t peakBytesQueued{};
+        /// Set by finish(), once no more frames will be pushed
+        bool finishing = false;
+        /// Set once every encoder thread has exited
+        bool encodersDone = false;
+
+        std::vector<std::thread> encoders{};
+        std::thread writer{};
+    };
+}
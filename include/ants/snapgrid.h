@@ -6,8 +6,10 @@
 #pragma once
 #include <cstdint>
 #include <cstring>
+#include <vector>
 #include "log/log.h"
 #include "ants/defines.h"
+#include "ants/gridbuffer.h"
 
 // Snapshot grid (SnapGrid) as documented in docs/parallel.md
 
@@ -18,27 +20,41 @@ namespace ants {
     template<typename T>
     struct SnapGrid2D {
         /// Constructs a new empty SnapGrid
-        explicit SnapGrid2D(int32_t width, int32_t height)  {
+        explicit SnapGrid2D(int32_t width, int32_t height, HugePageMode hugePages = HugePageMode::NONE)  {
             this->width = width;
             this->height = height;
             log_debug("new SnapGrid2D, width: %d, height: %d, array size: %d, bytes: %lu", width,
                       height, width * height, width * height * sizeof(T));
             log_debug("SnapGrid2D sizeof(T): %lu", sizeof(T));
-            clean = new T[width * height]{};
-            dirty = new T[width * height]{};
-#if USE_MPI
-            written = new bool[width * height]{};
-#endif
+            clean = GridBuffer<T>(width, height, 1, hugePages);
+            dirty = GridBuffer<T>(width, height, 1, hugePages);
         }
 
         SnapGrid2D() = default;
 
+        /// Starts recording which cells are written between commits, in SnapGrid2D::writeLog. Used by MPI.
+        void trackWrites() {
+            written = GridBuffer<bool>(width, height, 1, HugePageMode::NONE);
+            writeLog.clear();
+        }
+
         /// Writes a value into the dirty buffer
-        inline constexpr void write(int32_t x, int32_t y, T value) {
-            dirty[x + width * y] = value;
-#if USE_MPI
-            written[x + width * y] = true;
-#endif
+        inline void write(int32_t x, int32_t y, T value) {
+            size_t i = x + static_cast<size_t>(width) * y;
+            dirty[i] = value;
+            if (written.get() != nullptr && !written[i]) {
+                written[i] = true;
+                writeLog.push_back(i);
+            }
+        }
+
+        /// Forgets which cells were written since the last commit. Takes time proportional to the number
+        /// of cells written, not the size of the grid.
+        inline void clearWrites() {
+            for (auto i : writeLog) {
+                written[i] = false;
+            }
+            writeLog.clear();
         }
 
 
@@ -47,35 +63,48 @@ namespace ants {
             return clean[x + width * y];
         }
 
+        /// Writes a value straight into both buffers, i.e. a write that is committed immediately
+        inline constexpr void publish(int32_t x, int32_t y, T value) {
+            clean[x + width * y] = value;
+            dirty[x + width * y] = value;
+        }
+
         /**
          * Commits the dirty buffer, i.e. replaces the current clean buffer with the current dirty
          * buffer.
          */
-        inline constexpr void commit() {
-            memcpy(clean, dirty, width * height * sizeof(T));
-#if USE_MPI
-            memset(written, 0, width * height * sizeof(bool));
-#endif
+        inline void commit() {
+            memcpy(clean.get(), dirty.get(), width * height * sizeof(T));
+            clearWrites();
+        }
+
+        /// Commits only the rows [yBegin, yEnd) of the dirty buffer. Doesn't touch the write log, call
+        /// clearWrites() as well if the grid tracks writes.
+        inline constexpr void commitRows(int32_t yBegin, int32_t yEnd) {
+            size_t offset = static_cast<size_t>(width) * yBegin;
+            size_t count = static_cast<size_t>(width) * (yEnd - yBegin);
+            memcpy(clean.get() + offset, dirty.get() + offset, count * sizeof(T));
         }
 
         /// Computes the CRC32 hash of the dirty buffer. Used for data verification.
         inline constexpr uint32_t crc32Dirty() {
-            return crc32(dirty, width * height * sizeof(T));
+            return crc32(dirty.get(), width * height * sizeof(T));
         }
 
         /// Computes the CRC32 hash of the clean buffer. Used for data verification.
         inline constexpr uint32_t crc32Clean() {
-            return crc32(clean, width * height * sizeof(T));
+            return crc32(clean.get(), width * height * sizeof(T));
         }
 
         /// Clean buffer
-        T *clean{};
+        GridBuffer<T> clean{};
         /// Dirty buffer
-        T *dirty{};
-#if USE_MPI
-        /// Positions in the dirty array that have been written since the last flush
-        bool *written{};
-#endif
+        GridBuffer<T> dirty{};
+        /// Positions in the dirty array that have been written since the last flush, only allocated
+        /// if trackWrites() was called
+        GridBuffer<bool> written{};
+        /// Indices of the positions set in written, in the order they were first written
+        std::vector<size_t> writeLog{};
         int32_t width{}, height{};
     };
 
@@ -84,29 +113,44 @@ namespace ants {
     template<typename T>
     struct SnapGrid3D {
         /// Constructs a new empty SnapGrid
-        explicit SnapGrid3D(int32_t width, int32_t height, int32_t depth)  {
+        explicit SnapGrid3D(int32_t width, int32_t height, int32_t depth,
+                            HugePageMode hugePages = HugePageMode::NONE)  {
             this->width = width;
             this->height = height;
             this->depth = depth;
             log_debug("new SnapGrid3D, width: %d, height: %d, depth: %d, array size: %d, bytes: %lu", width,
                       height, depth, width * height * depth, width * height * depth * sizeof(T));
             log_debug("SnapGrid3D sizeof(T): %lu", sizeof(T));
-            clean = new T[width * height * depth]{};
-            dirty = new T[width * height * depth]{};
-#if USE_MPI
-            written = new bool[width * height * depth]{};
-#endif
+            clean = GridBuffer<T>(width, height, depth, hugePages);
+            dirty = GridBuffer<T>(width, height, depth, hugePages);
         }
 
         SnapGrid3D() = default;
 
+        /// Starts recording which cells are written between commits, in SnapGrid3D::writeLog. Used by MPI.
+        void trackWrites() {
+            written = GridBuffer<bool>(width, height, depth, HugePageMode::NONE);
+            writeLog.clear();
+        }
+
         /// Writes a value into the dirty buffer
         template<class I>
-        inline constexpr void write(int32_t x, int32_t y, I z, T value) {
-            dirty[x + width * y + width * height * z] = value;
-#if USE_MPI
-            written[x + width * y + width * height * z] = true;
-#endif
+        inline void write(int32_t x, int32_t y, I z, T value) {
+            size_t i = x + static_cast<size_t>(width) * y + static_cast<size_t>(width) * height * z;
+            dirty[i] = value;
+            if (written.get() != nullptr && !written[i]) {
+                written[i] = true;
+                writeLog.push_back(i);
+            }
+        }
+
+        /// Forgets which cells were written since the last commit. Takes time proportional to the number
+        /// of cells written, not the size of the grid.
+        inline void clearWrites() {
+            for (auto i : writeLog) {
+                written[i] = false;
+            }
+            writeLog.clear();
         }
 
         /// Reads a value from the snapshot grid, from the clean buffer
@@ -115,25 +159,46 @@ namespace ants {
             return clean[x + width * y + width * height * z];
         }
 
+        /// Reads a value from the dirty buffer, i.e. including writes made since the last commit
+        template<class I>
+        inline constexpr T readDirty(int32_t x, int32_t y, I z) const {
+            return dirty[x + width * y + width * height * z];
+        }
+
+        /// Returns the start of row y of layer z in the clean buffer, for loops over a run of cells
+        template<class I>
+        inline const T *cleanRow(int32_t y, I z) const {
+            return &clean[static_cast<size_t>(width) * y + static_cast<size_t>(width) * height * z];
+        }
+
+        /**
+         * Writes a value into both the clean and dirty buffers, which commits just this one cell.
+         * Used to fuse other work into the commit, must not be called while anyone is reading the grid.
+         */
+        template<class I>
+        inline constexpr void publish(int32_t x, int32_t y, I z, T value) {
+            clean[x + width * y + width * height * z] = value;
+            dirty[x + width * y + width * height * z] = value;
+        }
+
         /**
          * Commits the dirty buffer, i.e. replaces the current clean buffer with the current dirty
          * buffer.
          */
-        inline constexpr void commit() {
-            memcpy(clean, dirty, width * height * depth * sizeof(T));
-#if USE_MPI
-            memset(written, 0, width * height * depth * sizeof(bool));
-#endif
+        inline void commit() {
+            memcpy(clean.get(), dirty.get(), width * height * depth * sizeof(T));
+            clearWrites();
         }
 
         /// Clean buffer
-        T *clean{};
+        GridBuffer<T> clean{};
         /// Dirty buffer
-        T *dirty{};
-#if USE_MPI
-        /// Positions in the dirty array that have been written since the last flush
-        bool *written{};
-#endif
+        GridBuffer<T> dirty{};
+        /// Positions in the dirty array that have been written since the last flush, only allocated
+        /// if trackWrites() was called
+        GridBuffer<bool> written{};
+        /// Indices of the positions set in written, in the order they were first written
+        std::vector<size_t> writeLog{};
         int32_t width{}, height{}, depth{};
     };
 }
\ No newline at end of file
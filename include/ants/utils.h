@@ -5,15 +5,22 @@
 // http://mozilla.org/MPL/2.0/.
 #pragma once
 #include <cstdint>
+#include <cstdio>
 #include <functional>
 #include <string>
 #include <ostream>
 #include <cmath>
+#include <vector>
 #include "cereal/cereal.hpp"
 
 /// Divide to convert bytes to MiB
 #define BYTES2MIB 1048576
 
+/// Counts the time in milliseconds between end and begin as a double. The time is counted as nanoseconds
+/// for accuracy, then converted as a double to milliseconds.
+#define COUNT_MS(end, begin) static_cast<double>( \
+    std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()) / 1e6
+
 namespace ants {
     // Source: https://stackoverflow.com/a/2595226/5007892
     template <class T>
@@ -166,6 +173,16 @@ namespace ants {
      * Source: https://stackoverflow.com/a/29865/5007892
      */
     void hexdump(const void *ptr, size_t size);
+
+    /// Appends an unsigned LEB128 varint to the buffer, as used by the recording formats
+    void writeVarint(std::vector<uint8_t> &out, uint64_t value);
+
+    /// Reads a varint at pos in the buffer and moves pos past it, throwing if it runs off the end
+    uint64_t readVarint(const std::vector<uint8_t> &in, size_t &pos);
+
+    /// Reads a varint from a file. Returns false if the file ends before it starts, and throws if it ends
+    /// halfway through.
+    bool readVarint(FILE *file, uint64_t &value);
 }
 
 namespace std {
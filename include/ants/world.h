@@ -6,6 +6,7 @@
 #pragma once
 #include <cstdint>
 #include <array>
+#include <utility>
 #include <vector>
 #include "microtar/microtar.h"
 #include "ants/colony.h"
@@ -15,23 +16,35 @@
 #include "tinycolor/tinycolormap.hpp"
 #include "pcg/pcg_random.hpp"
 #include "ants/snapgrid.h"
+#include "ants/palette.h"
 #include "ants/defines.h"
 
 // World class header. Most of the simulator code is in world.cpp/world.h.
 
 namespace ants {
-    typedef enum {
-        /// Tag to indicate this message is food grid data
-        TAG_FOOD_DATA = 0,
-        /// Tag to indicate this message is food grid written or not table
-        TAG_FOOD_WRITTEN,
-        /// Tag to indicate this message is pheromone grid data
-        TAG_PHEROMONES_DATA,
-        /// Tag to indicate this message is pheromone grid written or not table
-        TAG_PHEROMONES_WRITTEN,
-        /// Tag to receive colony add ants
-        TAG_COLONY_ADD_ANTS,
-    } MPITag_t;
+    /// Value in World::homeZone for a cell that isn't near any colony
+    constexpr uint16_t HOME_ZONE_NONE = 0;
+    /// Value in World::homeZone for a cell that is near more than one colony
+    constexpr uint16_t HOME_ZONE_OVERLAP = UINT16_MAX;
+
+    /**
+     * Part of the world that frames show: the cells in the rectangle (x, y, width, height), keeping one cell
+     * (the top left) of every downsample x downsample block
+     */
+    struct FrameRegion {
+        int32_t x{}, y{}, width{}, height{};
+        int32_t downsample = 1;
+
+        /// Width of the frame in pixels
+        [[nodiscard]] inline int32_t frameWidth() const {
+            return (width + downsample - 1) / downsample;
+        }
+
+        /// Height of the frame in pixels
+        [[nodiscard]] inline int32_t frameHeight() const {
+            return (height + downsample - 1) / downsample;
+        }
+    };
 
     struct World {
         /// Instantiates a world from the given PNG file as per specifications
@@ -41,16 +54,11 @@ namespace ants {
 
         ~World() = default;
 
-        /// Updates the world for one time step
+        /// Updates the world for one time step, using OpenMP threads if World::threaded is set.
+        /// This is the serial and OpenMP backend, the MPI backends drive the world themselves.
         /// @return true if we should keep iterating the simulation, false if we should quit now
         [[nodiscard]] bool update();
 
-        /**
-         * Updates the world for one time step using MPI. Replaces World::update() when MPI is enabled.
-         * @return true if we should keep iterating the simulation, false if we should quit now
-         */
-        [[nodiscard]] bool updateMpi();
-
         /**
          * Sets up PNG TAR disk output. PNG files are written to a TAR file that can then be downloaded
          * later.
@@ -77,22 +85,63 @@ namespace ants {
         /// Finalises the PNG TAR recording. Must be called before program exit.
         void finaliseRecording();
 
-        /// Renders the current world to an uncompressed RGB pixel buffer.
+        /// Renders the current world's World::frameRegion to an uncompressed buffer of World::palette indices.
         [[nodiscard]] std::vector<uint8_t> renderWorldUncompressed() const;
 
+        /**
+         * Sets the part of the world that's rendered, clipped to the world. A region with no width or height
+         * is the whole world. Throws std::invalid_argument if the region is outside the world.
+         */
+        void setFrameRegion(FrameRegion region);
+
+        /// Returns the rows [begin, end) of the frame that show cells in the world rows [yBegin, yEnd)
+        [[nodiscard]] std::pair<int32_t, int32_t> frameRowsOf(int32_t yBegin, int32_t yEnd) const;
+
+        /**
+         * Starts keeping World::renderIntensity up to date, so rendering doesn't have to look at every
+         * colony's pheromones. Must be called before the backend is attached (the MPI backend shares it).
+         */
+        void trackRenderIntensity();
+
+        /// Returns the number of colonies that haven't died yet
+        [[nodiscard]] size_t countLiveColonies() const;
+
         size_t maxAntsLastTick{};
+        /// Most ants alive at once over the whole simulation
+        size_t maxAnts{};
+        /// Food remaining at the end of the last tick
+        int32_t foodLastTick{};
         int32_t width{};
         int32_t height{};
-#if USE_MPI
-        int32_t mpiWorldSize{};
-        int32_t mpiRank{};
-#endif
+        /// If true, the update and decay loops are run with OpenMP threads. Set by the backend.
+        bool threaded = false;
+        /// Palette that frames are rendered with, which is the same for the whole simulation
+        FramePalette palette{};
+        /// Part of the world that frames show, see World::setFrameRegion
+        FrameRegion frameRegion{};
     private:
+        // the MPI backends drive the world's update phases themselves
+        friend class MpiBackend;
+        friend class DomainBackend;
+        // the recorder writes to the TAR, and puts native recordings next to it
+        friend class Recorder;
+        // the event log reads the world's state each tick, and its replay rebuilds a world to render
+        friend class EventLogger;
+        friend class EventReplay;
+
+        /// Loads count doubles from random.bin (generated by dump_random.cpp), for the pheromone fuzz
+        [[nodiscard]] static std::vector<double> loadRandomBuffer(size_t count);
+
         /// Returns a random movement vector for the specified ant
         Vector2i randomMovementVector(const Ant &ant, pcg32_fast &localRng) const;
 
-        /// Decays pheromones in the grid
-        void decayPheromones();
+        /**
+         * Commits the pheromone grid and decays it, in one pass. This is the decay for the next tick,
+         * so the committed grid is exactly what the next tick's ants will see.
+         * @param tyBegin first row of activity tiles to decay
+         * @param tyEnd one past the last row of activity tiles to decay
+         */
+        void decayAndCommitPheromones(int32_t tyBegin, int32_t tyEnd);
 
         /**
          * Calculates the strongest direction vector, and its strength, based on the pheromones
@@ -100,48 +149,114 @@ namespace ants {
          * The output vector will depend on the mode of the ant (i.e. to food or to colony).
          * @param colony colony the ant belongs to
          * @param ant the ant to consider
+         * @param meta the ant's cold data
          * @return pair: first value is the strongest direction, second value is the strength
          */
-        [[nodiscard]] std::pair<Vector2i, double> computePheromoneVector(const Colony &colony, const Ant &ant) const;
+        [[nodiscard]] std::pair<Vector2i, double> computePheromoneVector(const Colony &colony, const Ant &ant,
+                                                                         const AntMeta &meta) const;
 
         /**
          * Updates a single ant in the world
          * @param ant ant to update
+         * @param meta the ant's cold data (see AntMeta)
          * @param colony pointer to colony being updated
          * @param localRng local pcg32 instance
          * @returns true if the colony should add more ants, false otherwise
          */
-        bool updateAnt(Ant *ant, Colony *colony, pcg32_fast &localRng);
+        bool updateAnt(Ant *ant, AntMeta *meta, Colony *colony, pcg32_fast &localRng);
 
-#if USE_MPI
         /**
-         * Updates the selected colonies and their ants, for use in MPI
-         * @param colonyWorkIdx indices of colonies to update, array of length mpiColoniesPerWorker
-         * @param colonyAddAnts for each ant in colonyWorkIdx, -1 if we should not add more ants, otherwise
-         * the colony index (we should add more ants)
-         * @param seed seed to initialise pcg32_fast rng with
+         * Leaves pheromone where the ant is standing: "to food" if it's holding food, otherwise "to colony".
+         * Several deposits on one cell in a tick don't add up, since each one adds to the committed value.
+         * Not thread safe.
          */
-        void updateColoniesMpi(int *colonyWorkIdx, int *colonyAddAnts, uint64_t seed);
+        void depositPheromone(const Ant &ant, int32_t colony);
 
         /**
-         * Packs the pheromone grid into a continuous data structure suitable for transmitting using
-         * MPI
-         * @return unique_ptr to allocated region of doubles
+         * Updates every ant of every live colony, using OpenMP threads if World::threaded is set
+         * @param seed seed for each thread's pcg32_fast rng
+         * @return colonies that had an ant return with food this tick (may repeat)
          */
-        std::unique_ptr<double[]> packPheromoneGrid();
+        std::vector<Colony *> updateAnts(uint64_t seed);
 
-        /// Unpacks a packed pheromone grid into the pheromone grid of this class
-        void unpackPheromoneGrid(const std::shared_ptr<double[]>& packedData);
-#endif
+        /// Spawns a new ant in the centre of the colony
+        void spawnAnt(Colony &colony);
 
-        /// Renders a pheromone to a colour value. Returns the colour value between 0.0 and 1.0.
-        [[nodiscard]] double pheromoneToColour(int32_t x, int32_t y) const;
+        /**
+         * Serial code run after all the ants have been updated: spawns ants, updates colony stats,
+         * commits the grids and checks if the simulation is over
+         * @param colonyAddAnts colonies that had an ant return with food this tick (may repeat)
+         * @return true if we should keep iterating the simulation, false if we should quit now
+         */
+        [[nodiscard]] bool finishTick(const std::vector<Colony *> &colonyAddAnts);
+
+        /**
+         * Boosts the colony's hunger because one of its ants returned home with food
+         * @param spawn if true, also spawn colonyAntsPerTick new ants at the colony
+         */
+        void feedColony(Colony &colony, bool spawn);
+
+        /**
+         * Drains each colony's hunger, kills colonies that have starved or have no ants, and updates
+         * the max ants statistics
+         * @param antCounts number of ants in each colony (which may live on other MPI ranks)
+         * @return number of ants in live colonies
+         */
+        size_t updateColonyStats(const std::vector<size_t> &antCounts);
+
+        /// Records the food remaining, then logs the reason and returns false if the simulation is over (no
+        /// ants or no food left)
+        [[nodiscard]] bool checkShouldContinue(size_t antsAlive, int32_t foodRemaining);
+
+        /// Index into tileActive for the tile (tx, ty) and colony c
+        [[nodiscard]] inline size_t tileIndex(int32_t tx, int32_t ty, int32_t c) const {
+            return tx + tilesX * ty + static_cast<size_t>(tilesX) * tilesY * c;
+        }
+
+        /// Marks the tile containing the cell (x, y) as active for the colony c
+        inline void markTileActive(int32_t x, int32_t y, int32_t c) {
+            tileActive[tileIndex(x / ACTIVITY_TILE_SIZE, y / ACTIVITY_TILE_SIZE, c)] = true;
+        }
+
+        /// Resets the render intensity of every cell in the tile (tx, ty) to no pheromone
+        void clearRenderIntensity(int32_t tx, int32_t ty);
 
-        /// MPI master update function
-        [[nodiscard]] bool updateMpiMaster();
+        /// Raises the render intensity of the cell (x, y) to the pheromone's, if it's stronger. The
+        /// palette's pheromone indices go up with the strength, so the max of the indices is the index of
+        /// the max.
+        inline void raiseRenderIntensity(int32_t x, int32_t y, PheromoneStrength strength) {
+            auto &cell = renderIntensity[x + static_cast<size_t>(width) * y];
+            cell = std::max(cell, palette.pheromone(std::max(strength.toColony, strength.toFood)));
+        }
 
-        /// MPI worker update function
-        [[nodiscard]] bool updateMpiWorker();
+        /// Returns true if pos is close enough to the colony for an ant to drop off its food there
+        [[nodiscard]] inline bool isInHomeZone(Vector2i pos, const Colony &colony) const {
+            auto zone = homeZone[pos.x + width * pos.y];
+            if (zone == HOME_ZONE_OVERLAP) {
+                // rare, so just fall back to the distance check
+                return pos.distance(colony.pos) <= colonyReturnDist;
+            }
+            return zone == colony.id + 1;
+        }
+
+        /// Builds the palette from the colonies, must be called once they're all created
+        void buildPalette();
+
+        /// Fills in homeZone from the colony positions, must be called after the INI is loaded
+        void buildHomeZones();
+
+        /// Returns true if the tile (tx, ty) is active for any colony
+        [[nodiscard]] bool isTileActive(int32_t tx, int32_t ty) const;
+
+        /// Recounts the food in the tile (tx, ty) into tileFood, from the clean food grid
+        void recountTileFood(int32_t tx, int32_t ty);
+
+        /// Counts the food remaining in the rows of tiles [tyBegin, tyEnd). Only active tiles are recounted.
+        [[nodiscard]] int32_t countFood(int32_t tyBegin, int32_t tyEnd);
+
+        /// Renders the rows [rowBegin, rowEnd) of the frame (see World::frameRegion) to an uncompressed buffer
+        /// of World::palette indices
+        [[nodiscard]] std::vector<uint8_t> renderRows(int32_t rowBegin, int32_t rowEnd) const;
 
 
         SnapGrid2D<bool> foodGrid{};
@@ -155,9 +270,30 @@ namespace ants {
         /// PRNG: we use PCG, and pcg64_fast, which doesn't say it has any worse statistical quality
         /// than pcg64, and has plenty large state for our use case
         pcg64_fast rng{};
-        /// Buffer of random values used in World::decayPheromones
+        /// ID given to the next spawned ant
+        uint64_t nextAntId{};
+        /// Added to nextAntId after each spawn, so that MPI ranks that spawn ants hand out different IDs
+        uint64_t antIdStride = 1;
+        /// Buffer of random values used in World::decayAndCommitPheromones
         std::vector<double> randomBuffer{};
 
+        /// For each cell (x + width * y), the colony id + 1 whose home zone (within colonyReturnDist)
+        /// covers it, HOME_ZONE_NONE, or HOME_ZONE_OVERLAP if several colonies' zones cover it.
+        /// This never changes after the world is constructed.
+        std::vector<uint16_t> homeZone{};
+
+        /// Number of activity tiles along each axis, see ACTIVITY_TILE_SIZE
+        int32_t tilesX{}, tilesY{};
+        /// For each tile and colony (see World::tileIndex), true if the tile holds any non-zero
+        /// pheromone or any ant of that colony. Inactive tiles are skipped by decay and rendering.
+        GridBuffer<uint8_t> tileActive{};
+        /// Number of food cells in each tile, indexed tx + tilesX * ty
+        GridBuffer<int32_t> tileFood{};
+        /// For each cell (x + width * y), the palette index of its strongest pheromone of any colony, as of
+        /// the last commit. Only allocated if trackRenderIntensity() was called. The decay pass rebuilds it
+        /// for every tile it touches, which takes in all the deposits (they're committed there too).
+        GridBuffer<uint8_t> renderIntensity{};
+
         /// INI values
         double pheromoneDecayFactor{};
         double pheromoneGainFactor{};
@@ -169,16 +305,14 @@ namespace ants {
         double colonyHungerDrain{}, colonyHungerReplenish{};
         int32_t colonyAntsPerTick{}, colonyReturnDist{};
 
+        /// Huge page backing used for the SnapGrid buffers
+        HugePageMode hugePageMode{};
+
         /// PNG TAR output file
         mtar_t tarfile{};
         /// true if PNG TAR recording initialised successfully
         bool tarfileOk = false;
         /// Path to where the recording is saved
         std::string recordingPath{};
-
-#if USE_MPI
-        // number of colonies per MPI worker
-        int32_t mpiColoniesPerWorker{};
-#endif
     };
 };
\ No newline at end of file
@@ -0,0 +1,22 @@
+#!/bin/bash -l
+#
+#SBATCH --job-name=ant_colony
+#SBATCH --nodes=4
+#SBATCH --ntasks=40
+#SBATCH --ntasks-per-node=10
+#SBATCH --cpus-per-task=1
+#SBATCH --mem=256GB
+#SBATCH --time=0-480:00
+#SBATCH -e log_%j.err
+#SBATCH -o log_%j.out
+
+# Slurm job for a seed/parameter sweep with the ensemble backend: every rank runs its own simulations,
+# set up with the [Ensemble] and [Sweep] sections of the config file
+
+module load gnu
+module load openmpi3_eth/3.0.0
+
+export OMP_NUM_THREADS=${SLURM_CPUS_PER_TASK}
+
+date
+mpiexec ./cmake-build-release-getafix/ant_colony antconfig.ini ensemble
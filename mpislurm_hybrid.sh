@@ -0,0 +1,25 @@
+#!/bin/bash -l
+#
+#SBATCH --job-name=ant_colony
+#SBATCH --nodes=4
+#SBATCH --ntasks=4
+#SBATCH --ntasks-per-node=1
+#SBATCH --cpus-per-task=10
+#SBATCH --mem=256GB
+#SBATCH --time=0-480:00
+#SBATCH -e log_%j.err
+#SBATCH -o log_%j.out
+
+# Slurm job for the hybrid MPI + OpenMP version of the ant colony: one rank per node, with OpenMP
+# threads inside each rank. For one rank per socket, double --ntasks and halve --cpus-per-task.
+
+module load gnu
+module load openmpi3_eth/3.0.0
+
+# write out number of threads
+export OMP_NUM_THREADS=${SLURM_CPUS_PER_TASK}
+export OMP_PROC_BIND=close
+export OMP_PLACES=cores
+
+date
+mpiexec --map-by ppr:1:node:pe=${SLURM_CPUS_PER_TASK} ./cmake-build-release-getafix/ant_colony antconfig_megamap_mpi.ini hybrid
@@ -18,4 +18,4 @@ module load gnu
 export OMP_NUM_THREADS=${SLURM_CPUS_PER_TASK}
 
 date
-mpiexec ./cmake-build-release-getafix/ant_colony antconfig_megamap_mpi.ini
\ No newline at end of file
+mpiexec ./cmake-build-release-getafix/ant_colony antconfig_megamap_mpi.ini omp
\ No newline at end of file
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Matt Young. All rights reserved.
+#
+# This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+# If a copy of the MPL was not distributed with this file, You can obtain one at
+# http://mozilla.org/MPL/2.0/.
+# Shows the newest frame of a running simulation, from the shared memory it publishes to with
+# live_view_name set (see include/ants/liveview.h). Must run on the same machine as the MPI master.
+# Usage: ./live_viewer.py [live_view_name]
+import os
+import sys
+import mmap
+import struct
+import time
+import cv2
+import numpy as np
+
+# Milliseconds between checks for a new frame
+POLL_MS = 10
+# Factor to resize the images by, 1.0 = same size
+SCALE_FACTOR = 5.0
+
+LATEST_OFFSET = 64
+FINISHED_OFFSET = 72
+PALETTE_OFFSET = 128
+PIXELS_OFFSET = 64
+
+
+class LiveRing:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.inode = os.fstat(f.fileno()).st_ino
+            self.mm = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        if self.mm[0:8] != b"ANTLIVE1":
+            raise ValueError(f"{path} isn't a live view (or it's still being set up)")
+        self.width, self.height, self.num_slots, num_colours, self.slots_offset, self.slot_bytes = \
+            struct.unpack_from("=IIIIQQ", self.mm, 8)
+        # BGR for OpenCV
+        palette = np.frombuffer(self.mm, dtype=np.uint8, count=num_colours * 3, offset=PALETTE_OFFSET)
+        self.palette = np.zeros((256, 3), dtype=np.uint8)
+        self.palette[:num_colours] = palette.reshape(-1, 3)[:, ::-1]
+
+    def latest(self):
+        return struct.unpack_from("=Q", self.mm, LATEST_OFFSET)[0]
+
+    def finished(self):
+        return struct.unpack_from("=Q", self.mm, FINISHED_OFFSET)[0] != 0
+
+    def read(self, frame):
+        """Returns the tick and colour image of frame number frame - 1, or None if it was overwritten"""
+        slot = self.slots_offset + self.slot_bytes * ((frame - 1) % self.num_slots)
+        sequence, tick = struct.unpack_from("=Qq", self.mm, slot)
+        if sequence != frame:
+            return None
+        # a view straight into the shared memory, which is only copied by the palette lookup
+        pixels = np.frombuffer(self.mm, dtype=np.uint8, count=self.width * self.height,
+                               offset=slot + PIXELS_OFFSET).reshape(self.height, self.width)
+        img = self.palette[pixels]
+        # the simulation never waits for us, so check it didn't start overwriting the slot while we read it
+        if struct.unpack_from("=Q", self.mm, slot)[0] != frame:
+            return None
+        return tick, img
+
+
+if __name__ == "__main__":
+    name = sys.argv[1] if len(sys.argv) >= 2 else "/ant_colony_live"
+    path = "/dev/shm/" + name.lstrip("/")
+    ring = None
+    shown = 0
+    while True:
+        if ring is None or ring.finished():
+            # wait for the simulation to start, or for the next run once this one is done
+            try:
+                if ring is None or os.stat(path).st_ino != ring.inode:
+                    ring = LiveRing(path)
+                    shown = 0
+                    print(f"Showing {ring.width}x{ring.height} frames from {path}")
+            except (FileNotFoundError, ValueError):
+                pass
+        if ring is None:
+            time.sleep(POLL_MS / 1000.0)
+            continue
+
+        latest = ring.latest()
+        if latest != shown:
+            frame = ring.read(latest)
+            if frame is not None:
+                tick, img = frame
+                img = cv2.resize(img, (0, 0), fx=SCALE_FACTOR, fy=SCALE_FACTOR, interpolation=cv2.INTER_NEAREST)
+                cv2.imshow("Live", img)
+                cv2.setWindowTitle("Live", f"Tick {tick}")
+                shown = latest
+        key = cv2.waitKey(POLL_MS)
+        # check if escape was pressed
+        if key == 27:
+            break
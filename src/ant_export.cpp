@@ -0,0 +1,70 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#include <string>
+#include <vector>
+#include <omp.h>
+#include "ants/antrec.h"
+#include "ants/png.h"
+#include "ants/filewriter.h"
+#include "microtar/microtar.h"
+#include "log/log.h"
+
+// This file converts a native recording (recording_format = native) to a PNG TAR, in the same layout
+// as recording_format = png, so it can be loaded into visualiser.py.
+// Usage: ./ant_export <recording.antrec> [output.tar]
+// The output defaults to the recording's path, with _png.tar instead of .antrec.
+
+using namespace ants;
+
+int main(int argc, char *argv[]) {
+    log_set_level(LOG_DEBUG);
+    if (argc < 2 || argc > 3) {
+        log_error("Usage: ./ant_export <recording.antrec> [output.tar]");
+        exit(1);
+    }
+    std::string inputPath = argv[1];
+    std::string outputPath = argc == 3 ? argv[2] : inputPath.substr(0, inputPath.rfind(".antrec")) + "_png.tar";
+
+    AntrecDecoder decoder(inputPath);
+    log_info("Recording %s is %dx%d, with a keyframe every %d frames", inputPath.c_str(), decoder.width,
+             decoder.height, decoder.keyframeInterval);
+    mtar_t tar{};
+    int err = mtarOpenAsync(&tar, outputPath);
+    if (err != 0) {
+        log_error("Failed to create %s: %s", outputPath.c_str(), mtar_strerror(err));
+        exit(1);
+    }
+
+    // each frame depends on the last, so they're decoded in order, then a batch at a time is PNG encoded in
+    // parallel and written out in order
+    auto batchSize = static_cast<size_t>(4 * omp_get_max_threads());
+    std::vector<std::vector<uint8_t>> frames(batchSize), pngs(batchSize);
+    size_t numFrames = 0;
+    bool more = true;
+    while (more) {
+        size_t count = 0;
+        while (count < batchSize && (more = decoder.readFrame(frames[count]))) {
+            count++;
+        }
+
+#pragma omp parallel for default(none) shared(count, frames, pngs, decoder) schedule(dynamic)
+        for (size_t i = 0; i < count; i++) {
+            std::vector<PngStrip> strips{deflatePngStrip(frames[i].data(), decoder.width, 3, 0, decoder.height,
+                                                         true)};
+            pngs[i] = assemblePng(decoder.width, decoder.height, 3, strips);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            auto name = std::to_string(numFrames++) + ".png";
+            mtar_write_file_header(&tar, name.c_str(), pngs[i].size());
+            mtar_write_data(&tar, pngs[i].data(), pngs[i].size());
+        }
+    }
+
+    mtar_finalize(&tar);
+    mtar_close(&tar);
+    log_info("Exported %zu frames to %s", numFrames, outputPath.c_str());
+}
@@ -0,0 +1,125 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include <omp.h>
+#include "ants/eventlog.h"
+#include "ants/png.h"
+#include "ants/filewriter.h"
+#include "microtar/microtar.h"
+#include "log/log.h"
+
+// This file renders an event log (recording_format = events) to a PNG TAR, in the same layout as
+// recording_format = png, so it can be loaded into visualiser.py.
+// Usage: ./ant_render <recording.antlog> [--stride N] [--size WxH] [--output output.tar]
+// --stride renders every Nth tick (default 1), --size scales the frames (nearest neighbour, default the
+// map size), and the output defaults to the log's path, with _png.tar instead of .antlog.
+// random.bin must be in the working directory, as for the simulator.
+
+using namespace ants;
+
+static void usage() {
+    log_error("Usage: ./ant_render <recording.antlog> [--stride N] [--size WxH] [--output output.tar]");
+    exit(1);
+}
+
+/// Renders the replay's world at its current tick (the world splits the rows between threads), then scales it
+static void renderFrame(const EventReplay &replay, int32_t outWidth, int32_t outHeight, std::vector<uint8_t> &out) {
+    int32_t width = replay.width(), height = replay.height();
+    auto full = replay.renderRows(0, height);
+    if (outWidth == width && outHeight == height) {
+        out = std::move(full);
+        return;
+    }
+
+    out.resize(static_cast<size_t>(outWidth) * outHeight);
+#pragma omp parallel for default(none) shared(full, out, outWidth, outHeight, width, height) schedule(static)
+    for (int32_t y = 0; y < outHeight; y++) {
+        auto srcY = static_cast<int32_t>(static_cast<int64_t>(y) * height / outHeight);
+        for (int32_t x = 0; x < outWidth; x++) {
+            auto srcX = static_cast<int32_t>(static_cast<int64_t>(x) * width / outWidth);
+            out[static_cast<size_t>(outWidth) * y + x] = full[static_cast<size_t>(width) * srcY + srcX];
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    log_set_level(LOG_INFO);
+    if (argc < 2) {
+        usage();
+    }
+    std::string inputPath = argv[1];
+    std::string outputPath = inputPath.substr(0, inputPath.rfind(".antlog")) + "_png.tar";
+    int32_t stride = 1, outWidth = 0, outHeight = 0;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+        }
+        std::string value = argv[++i];
+        if (arg == "--stride") {
+            stride = std::stoi(value);
+        } else if (arg == "--size") {
+            if (sscanf(value.c_str(), "%dx%d", &outWidth, &outHeight) != 2) {
+                usage();
+            }
+        } else if (arg == "--output") {
+            outputPath = value;
+        } else {
+            usage();
+        }
+    }
+
+    EventReplay replay(inputPath);
+    replay.setThreaded(true);
+    if (outWidth <= 0 || outHeight <= 0) {
+        outWidth = replay.width();
+        outHeight = replay.height();
+    }
+    if (stride < 1) {
+        usage();
+    }
+    log_info("Rendering every %d tick(s) at %dx%d", stride, outWidth, outHeight);
+
+    mtar_t tar{};
+    int err = mtarOpenAsync(&tar, outputPath);
+    if (err != 0) {
+        log_error("Failed to create %s: %s", outputPath.c_str(), mtar_strerror(err));
+        exit(1);
+    }
+
+    // the ticks have to be replayed in order, but each frame is rendered by all the threads, and a batch
+    // at a time is PNG encoded in parallel and written out in order
+    auto batchSize = static_cast<size_t>(4 * omp_get_max_threads());
+    std::vector<std::vector<uint8_t>> frames(batchSize), pngs(batchSize);
+    size_t numTicks = 0, numFrames = 0, count = 0;
+    bool more = true;
+    while (more) {
+        more = replay.nextTick();
+        if (more && numTicks++ % stride == 0) {
+            renderFrame(replay, outWidth, outHeight, frames[count++]);
+        }
+        if (count == batchSize || (!more && count != 0)) {
+#pragma omp parallel for default(none) shared(count, frames, pngs, outWidth, outHeight, replay) schedule(dynamic)
+            for (size_t i = 0; i < count; i++) {
+                std::vector<PngStrip> strips{deflatePngStrip(frames[i].data(), outWidth, 1, 0, outHeight, true, true)};
+                pngs[i] = assemblePng(outWidth, outHeight, 1, strips, replay.palette());
+            }
+            for (size_t i = 0; i < count; i++) {
+                auto name = std::to_string(numFrames++) + ".png";
+                mtar_write_file_header(&tar, name.c_str(), pngs[i].size());
+                mtar_write_data(&tar, pngs[i].data(), pngs[i].size());
+            }
+            count = 0;
+        }
+    }
+
+    mtar_finalize(&tar);
+    mtar_close(&tar);
+    log_info("Replayed %zu ticks, rendered %zu frames to %s", numTicks, numFrames, outputPath.c_str());
+}
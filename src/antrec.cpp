@@ -0,0 +1,180 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <zlib.h>
+#include "ants/antrec.h"
+#include "ants/utils.h"
+
+using namespace ants;
+
+constexpr char ANTREC_MAGIC[8] = {'A', 'N', 'T', 'R', 'E', 'C', '0', '1'};
+/// Largest palette that the encoder's 8 bit frames can index (the decoder takes up to 16 bit indices)
+constexpr size_t ANTREC_MAX_PALETTE = UINT8_MAX + 1;
+
+static void writeU32(std::vector<uint8_t> &out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back(value >> (8 * i));
+    }
+}
+
+AntrecEncoder::AntrecEncoder(int32_t width, int32_t height, int32_t keyframeInterval,
+                             const std::vector<RGBColour> &palette)
+    : width(width), height(height), keyframeInterval(std::max(keyframeInterval, 1)), palette(palette),
+      previous(static_cast<size_t>(width) * height) {
+    if (palette.size() > ANTREC_MAX_PALETTE) {
+        throw std::invalid_argument("Palette is too big for a recording");
+    }
+}
+
+std::vector<uint8_t> AntrecEncoder::encodeHeader() const {
+    std::vector<uint8_t> out(ANTREC_MAGIC, ANTREC_MAGIC + sizeof(ANTREC_MAGIC));
+    writeU32(out, width);
+    writeU32(out, height);
+    writeU32(out, keyframeInterval);
+    return out;
+}
+
+std::vector<uint8_t> AntrecEncoder::encodeFrame(const uint8_t *frame) {
+    uint8_t flags = 0;
+    if (framesSinceKeyframe < 0 || framesSinceKeyframe + 1 >= keyframeInterval) {
+        flags |= ANTREC_KEYFRAME;
+        framesSinceKeyframe = 0;
+    } else {
+        framesSinceKeyframe++;
+    }
+    bool keyframe = flags & ANTREC_KEYFRAME;
+    // the palette never changes, but every keyframe carries all of it (at most 768 bytes), so a recording
+    // can be decoded from any keyframe
+    std::vector<uint8_t> newColours{};
+    if (keyframe) {
+        flags |= ANTREC_PALETTE_RESET;
+        for (const auto &colour : palette) {
+            newColours.insert(newColours.end(), {colour.r, colour.g, colour.b});
+        }
+    }
+
+    std::vector<uint8_t> runs{};
+    size_t size = previous.size();
+    size_t i = 0;
+    while (i < size) {
+        size_t j = i + 1;
+        if (!keyframe && frame[i] == previous[i]) {
+            // unchanged since the last frame
+            while (j < size && frame[j] == previous[j]) {
+                j++;
+            }
+            writeVarint(runs, (j - i) << 1);
+        } else {
+            while (j < size && frame[j] == frame[i]) {
+                j++;
+            }
+            writeVarint(runs, ((j - i) << 1) | 1);
+            writeVarint(runs, frame[i]);
+        }
+        i = j;
+    }
+    std::copy(frame, frame + size, previous.begin());
+
+    // a fast LZ pass over the runs, since the slower zlib levels barely do any better on them
+    auto compressedBound = compressBound(runs.size());
+    std::vector<uint8_t> compressed(compressedBound);
+    if (compress2(compressed.data(), &compressedBound, runs.data(), runs.size(), Z_BEST_SPEED) != Z_OK) {
+        throw std::runtime_error("Failed to compress recording frame");
+    }
+
+    std::vector<uint8_t> out{flags};
+    writeVarint(out, newColours.size() / 3);
+    out.insert(out.end(), newColours.begin(), newColours.end());
+    writeVarint(out, runs.size());
+    writeVarint(out, compressedBound);
+    out.insert(out.end(), compressed.begin(), compressed.begin() + static_cast<ptrdiff_t>(compressedBound));
+    return out;
+}
+
+AntrecDecoder::AntrecDecoder(const std::string &path) {
+    file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        std::ostringstream oss;
+        oss << "Failed to open recording " << path << ": " << strerror(errno);
+        throw std::runtime_error(oss.str());
+    }
+    uint8_t header[sizeof(ANTREC_MAGIC) + 12];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, ANTREC_MAGIC, sizeof(ANTREC_MAGIC)) != 0) {
+        fclose(file);
+        std::ostringstream oss;
+        oss << path << " is not an ant recording";
+        throw std::runtime_error(oss.str());
+    }
+    auto readU32 = [&](size_t offset) {
+        return static_cast<int32_t>(header[offset] | (header[offset + 1] << 8) | (header[offset + 2] << 16) |
+                                    (static_cast<uint32_t>(header[offset + 3]) << 24));
+    };
+    width = readU32(sizeof(ANTREC_MAGIC));
+    height = readU32(sizeof(ANTREC_MAGIC) + 4);
+    keyframeInterval = readU32(sizeof(ANTREC_MAGIC) + 8);
+    indices.resize(static_cast<size_t>(width) * height);
+}
+
+AntrecDecoder::~AntrecDecoder() {
+    fclose(file);
+}
+
+bool AntrecDecoder::readFrame(std::vector<uint8_t> &rgb) {
+    int flags = fgetc(file);
+    if (flags == EOF) {
+        return false;
+    }
+    uint64_t numColours = 0, runsSize = 0, compressedSize = 0;
+    if (!readVarint(file, numColours)) {
+        throw std::runtime_error("Corrupt recording: truncated frame");
+    }
+    if (flags & ANTREC_PALETTE_RESET) {
+        palette.clear();
+    }
+    auto paletteEnd = palette.size();
+    palette.resize(paletteEnd + 3 * numColours);
+    if (fread(palette.data() + paletteEnd, 1, 3 * numColours, file) != 3 * numColours ||
+        !readVarint(file, runsSize) || !readVarint(file, compressedSize)) {
+        throw std::runtime_error("Corrupt recording: truncated frame");
+    }
+    compressed.resize(compressedSize);
+    runs.resize(runsSize);
+    uLongf decompressedSize = runsSize;
+    if (fread(compressed.data(), 1, compressedSize, file) != compressedSize ||
+        uncompress(runs.data(), &decompressedSize, compressed.data(), compressedSize) != Z_OK ||
+        decompressedSize != runsSize) {
+        throw std::runtime_error("Corrupt recording: bad frame data");
+    }
+
+    size_t pos = 0, i = 0;
+    while (pos < runs.size()) {
+        auto run = readVarint(runs, pos);
+        auto length = run >> 1;
+        if (length > indices.size() - i) {
+            throw std::runtime_error("Corrupt recording: run past the end of the frame");
+        }
+        if (run & 1) {
+            auto index = readVarint(runs, pos);
+            if (3 * index >= palette.size()) {
+                throw std::runtime_error("Corrupt recording: colour not in the palette");
+            }
+            std::fill(indices.begin() + static_cast<ptrdiff_t>(i), indices.begin() + static_cast<ptrdiff_t>(i + length),
+                      static_cast<uint16_t>(index));
+        }
+        i += length;
+    }
+
+    rgb.resize(3 * indices.size());
+    for (size_t p = 0; p < indices.size(); p++) {
+        std::memcpy(rgb.data() + 3 * p, palette.data() + 3 * indices[p], 3);
+    }
+    return true;
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#include <stdexcept>
+#include <omp.h>
+#include "ants/backend.h"
+#include "ants/mpi_backend.h"
+#include "ants/domain_backend.h"
+#include "ants/world.h"
+#include "log/log.h"
+
+using namespace ants;
+
+std::vector<uint8_t> Backend::render(const World &world) {
+    if (!isMaster()) {
+        return {};
+    }
+    return world.renderWorldUncompressed();
+}
+
+void SerialBackend::attach(World &world) {
+    log_info("Using serial ant update");
+    world.threaded = false;
+}
+
+bool SerialBackend::update(World &world) {
+    return world.update();
+}
+
+void OmpBackend::attach(World &world) {
+#pragma omp parallel default(none)
+    {
+#pragma omp master
+        log_info("Using OpenMP ant update with %d thread(s)", omp_get_num_threads());
+    }
+    world.threaded = true;
+}
+
+bool OmpBackend::update(World &world) {
+    return world.update();
+}
+
+std::unique_ptr<Backend> ants::createBackend(const std::string &name, mINI::INIStructure &config, int *argc,
+                                             char ***argv) {
+    if (name == "serial") {
+        return std::make_unique<SerialBackend>();
+    } else if (name == "omp") {
+        return std::make_unique<OmpBackend>();
+    } else if (name == "mpi") {
+        return std::make_unique<MpiBackend>(argc, argv, false, config);
+    } else if (name == "hybrid") {
+        return std::make_unique<MpiBackend>(argc, argv, true, config);
+    } else if (name == "domain") {
+        return std::make_unique<DomainBackend>(argc, argv);
+    }
+    throw std::invalid_argument("Unknown backend '" + name + "' (expected serial, omp, mpi, hybrid or domain)");
+}
@@ -0,0 +1,452 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
+#include <mpi.h>
+#include <omp.h>
+#include "ants/domain_backend.h"
+#include "ants/mpi_backend.h"
+#include "ants/world.h"
+#include "log/log.h"
+#include "cereal/types/vector.hpp"
+#include "cereal/archives/binary.hpp"
+
+using namespace ants;
+
+namespace {
+    /// An ant that walked out of one rank's strip into a neighbour's
+    struct MigratingAnt {
+        uint32_t colony{};
+        Ant ant{};
+        AntMeta meta{};
+
+        template<class Archive>
+        void serialize(Archive & archive) {
+            archive(colony, ant, meta);
+        }
+    };
+
+    /// Pheromone left by an ant in a halo row, which is added to the owning rank's grid
+    struct HaloDeposit {
+        Vector2i pos{};
+        uint32_t colony{};
+        PheromoneStrength amount{};
+
+        template<class Archive>
+        void serialize(Archive & archive) {
+            archive(pos, colony, amount);
+        }
+    };
+
+    /// Everything that crossed a strip boundary during the ant update
+    struct BoundaryMessage {
+        std::vector<MigratingAnt> ants{};
+        std::vector<HaloDeposit> deposits{};
+        /// Cells in the receiver's strip where the sender's ants took food
+        std::vector<Vector2i> foodTaken{};
+
+        template<class Archive>
+        void serialize(Archive & archive) {
+            archive(ants, deposits, foodTaken);
+        }
+    };
+
+    /**
+     * One committed edge row of a strip. Only the parts of the row in active tiles are sent, everything
+     * else is known to be zero.
+     */
+    struct HaloMessage {
+        int32_t y{};
+        /// Food grid row
+        std::vector<uint8_t> food{};
+        /// Activity tiles included, each encoded as tx + tilesX * colony
+        std::vector<int64_t> tiles{};
+        /// Pheromone grid row within each tile in tiles, in the same order
+        std::vector<PheromoneStrength> pheromones{};
+
+        template<class Archive>
+        void serialize(Archive & archive) {
+            archive(y, food, tiles, pheromones);
+        }
+    };
+
+    template<typename T>
+    std::string pack(const T &message) {
+        std::ostringstream oss;
+        {
+            cereal::BinaryOutputArchive ar(oss);
+            ar(message);
+            // once out of scope, cereal will flush the stream
+        }
+        return oss.str();
+    }
+
+    template<typename T>
+    T unpack(const std::string &data) {
+        T message{};
+        std::istringstream iss(data);
+        cereal::BinaryInputArchive ar(iss);
+        ar(message);
+        return message;
+    }
+}
+
+DomainBackend::DomainBackend(int *argc, char ***argv) {
+    log_info("Using MPI domain decomposition ant update. Number of strips will be determined shortly.");
+    // OpenMP threads can still be used inside each rank
+    initialiseMpi(argc, argv, true);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpiWorldSize);
+    MPI_Comm_rank(MPI_COMM_WORLD, &mpiRank);
+    log_info("MPI world size: %d, my rank: %d", mpiWorldSize, mpiRank);
+}
+
+DomainBackend::~DomainBackend() {
+    for (auto exchange : {&boundaryExchange, &haloExchange}) {
+        for (auto &request : exchange->sizeRequests) {
+            if (request != MPI_REQUEST_NULL) {
+                MPI_Request_free(&request);
+            }
+        }
+    }
+    MPI_Finalize();
+}
+
+std::pair<int32_t, int32_t> DomainBackend::tileRowsOf(int32_t rank, int32_t tilesY) const {
+    // strips are whole rows of activity tiles, so each rank decays and counts food only in its own tiles
+    auto begin = static_cast<int32_t>(static_cast<int64_t>(tilesY) * rank / mpiWorldSize);
+    auto end = static_cast<int32_t>(static_cast<int64_t>(tilesY) * (rank + 1) / mpiWorldSize);
+    return {begin, end};
+}
+
+void DomainBackend::attach(World &world) {
+    world.threaded = true;
+    if (world.tilesY < mpiWorldSize) {
+        std::ostringstream oss;
+        oss << "Map is too short to split into " << mpiWorldSize << " strips (it has " << world.tilesY
+            << " rows of " << ACTIVITY_TILE_SIZE << " cell tiles)";
+        throw std::runtime_error(oss.str());
+    }
+    std::tie(tyBegin, tyEnd) = tileRowsOf(mpiRank, world.tilesY);
+    yBegin = tyBegin * ACTIVITY_TILE_SIZE;
+    yEnd = std::min(tyEnd * ACTIVITY_TILE_SIZE, world.height);
+    neighbourUp = mpiRank > 0 ? mpiRank - 1 : MPI_PROC_NULL;
+    neighbourDown = mpiRank < mpiWorldSize - 1 ? mpiRank + 1 : MPI_PROC_NULL;
+    initExchange(boundaryExchange, TAG_DOMAIN_BOUNDARY);
+    initExchange(haloExchange, TAG_DOMAIN_HALO);
+    log_info("MPI rank %d owns rows %d to %d with %d OpenMP thread(s)", mpiRank, yBegin, yEnd - 1,
+             omp_get_max_threads());
+
+    // every rank loaded the whole map, so just drop the ants that aren't in our strip
+    size_t kept = 0;
+    for (auto &colony : world.colonies) {
+        size_t out = 0;
+        for (size_t a = 0; a < colony.ants.size(); a++) {
+            if (owns(colony.ants[a].y)) {
+                // careful not to self-move, that would empty visitedPos
+                if (out != a) {
+                    colony.ants[out] = colony.ants[a];
+                    colony.antMeta[out] = std::move(colony.antMeta[a]);
+                }
+                out++;
+            }
+        }
+        colony.ants.resize(out);
+        colony.antMeta.resize(out);
+        kept += out;
+    }
+    log_debug("MPI rank %d starts with %zu ants", mpiRank, kept);
+
+    // only the rank owning a colony spawns its ants, so give each rank its own series of ant IDs
+    world.nextAntId += mpiRank;
+    world.antIdStride = mpiWorldSize;
+}
+
+void DomainBackend::initExchange(NeighbourExchange &exchange, int tag) const {
+    exchange.tag = tag;
+    int neighbours[] = {neighbourUp, neighbourDown};
+    for (int i = 0; i < 2; i++) {
+        MPI_Send_init(&exchange.sendSizes[i], 1, MPI_UINT64_T, neighbours[i], tag, MPI_COMM_WORLD,
+                      &exchange.sizeRequests[i]);
+        MPI_Recv_init(&exchange.recvSizes[i], 1, MPI_UINT64_T, neighbours[i], tag, MPI_COMM_WORLD,
+                      &exchange.sizeRequests[2 + i]);
+    }
+}
+
+void DomainBackend::startExchange(NeighbourExchange &exchange, std::string toUp, std::string toDown) const {
+    int neighbours[] = {neighbourUp, neighbourDown};
+    exchange.sent = {std::move(toUp), std::move(toDown)};
+    for (int i = 0; i < 2; i++) {
+        exchange.sendSizes[i] = exchange.sent[i].size();
+        // receives from MPI_PROC_NULL leave the buffer alone
+        exchange.recvSizes[i] = 0;
+    }
+    MPI_Startall(static_cast<int>(exchange.sizeRequests.size()), exchange.sizeRequests.data());
+    // messages between two ranks with the same tag arrive in order, so the receiver gets the size first
+    for (int i = 0; i < 2; i++) {
+        MPI_Isend(exchange.sent[i].data(), static_cast<int>(exchange.sent[i].size()), MPI_BYTE, neighbours[i],
+                  exchange.tag, MPI_COMM_WORLD, &exchange.dataRequests[i]);
+    }
+}
+
+void DomainBackend::finishExchange(NeighbourExchange &exchange) const {
+    int neighbours[] = {neighbourUp, neighbourDown};
+    MPI_Waitall(static_cast<int>(exchange.sizeRequests.size()), exchange.sizeRequests.data(), MPI_STATUSES_IGNORE);
+    for (int i = 0; i < 2; i++) {
+        exchange.received[i].assign(exchange.recvSizes[i], '\0');
+        MPI_Irecv(exchange.received[i].data(), static_cast<int>(exchange.recvSizes[i]), MPI_BYTE, neighbours[i],
+                  exchange.tag, MPI_COMM_WORLD, &exchange.dataRequests[2 + i]);
+    }
+    MPI_Waitall(static_cast<int>(exchange.dataRequests.size()), exchange.dataRequests.data(), MPI_STATUSES_IGNORE);
+}
+
+void DomainBackend::sendBoundary(World &world) {
+    BoundaryMessage toUp{}, toDown{};
+
+    // ants that walked off our strip now belong to the neighbour. ants only move one cell per tick, so
+    // they can only be in one of the halo rows.
+    for (auto &colony : world.colonies) {
+        size_t out = 0;
+        for (size_t a = 0; a < colony.ants.size(); a++) {
+            auto &ant = colony.ants[a];
+            if (owns(ant.y)) {
+                if (out != a) {
+                    colony.ants[out] = ant;
+                    colony.antMeta[out] = std::move(colony.antMeta[a]);
+                }
+                out++;
+            } else {
+                auto &dest = ant.y < yBegin ? toUp : toDown;
+                dest.ants.push_back({colony.id, ant, std::move(colony.antMeta[a])});
+            }
+        }
+        colony.ants.resize(out);
+        colony.antMeta.resize(out);
+    }
+
+    // pheromone deposited and food taken in the halo rows. deposits always mark their tile active, so
+    // only active tiles need checking. ants write clean + pheromoneGainFactor, so however many of ours
+    // deposited on a cell, it's one gain, which is sent exactly (rather than as dirty - clean).
+    auto numColonies = static_cast<int32_t>(world.colonies.size());
+    auto gainIf = [&](bool deposited) { return deposited ? world.pheromoneGainFactor : 0.0; };
+    for (auto [y, message] : {std::pair{yBegin - 1, &toUp}, std::pair{yEnd, &toDown}}) {
+        if (y < 0 || y >= world.height) {
+            continue;
+        }
+        int32_t ty = y / ACTIVITY_TILE_SIZE;
+        for (int32_t c = 0; c < numColonies; c++) {
+            for (int32_t tx = 0; tx < world.tilesX; tx++) {
+                if (!world.tileActive[world.tileIndex(tx, ty, c)]) {
+                    continue;
+                }
+                int32_t xEnd = std::min(world.width, (tx + 1) * ACTIVITY_TILE_SIZE);
+                for (int32_t x = tx * ACTIVITY_TILE_SIZE; x < xEnd; x++) {
+                    auto before = world.pheromoneGrid.read(x, y, c);
+                    auto after = world.pheromoneGrid.readDirty(x, y, c);
+                    if (after.toColony != before.toColony || after.toFood != before.toFood) {
+                        message->deposits.push_back({Vector2i(x, y), static_cast<uint32_t>(c),
+                                                     PheromoneStrength(gainIf(after.toColony != before.toColony),
+                                                                       gainIf(after.toFood != before.toFood))});
+                    }
+                }
+            }
+        }
+        for (int32_t x = 0; x < world.width; x++) {
+            if (world.foodGrid.read(x, y) && !world.foodGrid.dirty[x + world.width * y]) {
+                message->foodTaken.emplace_back(x, y);
+            }
+        }
+    }
+
+    startExchange(boundaryExchange, pack(toUp), pack(toDown));
+}
+
+void DomainBackend::receiveBoundary(World &world) {
+    finishExchange(boundaryExchange);
+
+    foodTakenByNeighbours.clear();
+    // from below first, then from above
+    for (const auto &data : {boundaryExchange.received[1], boundaryExchange.received[0]}) {
+        if (data.empty()) {
+            continue;
+        }
+        auto message = unpack<BoundaryMessage>(data);
+        for (auto &migrant : message.ants) {
+            auto &colony = world.colonies[migrant.colony];
+            colony.ants.push_back(migrant.ant);
+            colony.antMeta.push_back(std::move(migrant.meta));
+        }
+        // if our ants deposited on the cell too, it still only gets one gain, just like two ants in the serial
+        // backend, so the result doesn't depend on where the strips are split
+        for (const auto &deposit : message.deposits) {
+            auto clean = world.pheromoneGrid.read(deposit.pos.x, deposit.pos.y, deposit.colony);
+            auto cur = world.pheromoneGrid.readDirty(deposit.pos.x, deposit.pos.y, deposit.colony);
+            cur.toColony = std::max(cur.toColony, clean.toColony + deposit.amount.toColony);
+            cur.toFood = std::max(cur.toFood, clean.toFood + deposit.amount.toFood);
+            world.pheromoneGrid.write(deposit.pos.x, deposit.pos.y, deposit.colony, cur);
+            world.markTileActive(deposit.pos.x, deposit.pos.y, static_cast<int32_t>(deposit.colony));
+        }
+        for (const auto &pos : message.foodTaken) {
+            world.foodGrid.write(pos.x, pos.y, false);
+            foodTakenByNeighbours.push_back(pos);
+        }
+    }
+}
+
+void DomainBackend::sendHalos(World &world) {
+    auto numColonies = static_cast<int32_t>(world.colonies.size());
+
+    // our edge rows, as committed
+    auto packRow = [&](int32_t y) {
+        HaloMessage message{};
+        message.y = y;
+        message.food.resize(world.width);
+        for (int32_t x = 0; x < world.width; x++) {
+            message.food[x] = world.foodGrid.read(x, y);
+        }
+        int32_t ty = y / ACTIVITY_TILE_SIZE;
+        for (int32_t c = 0; c < numColonies; c++) {
+            for (int32_t tx = 0; tx < world.tilesX; tx++) {
+                if (!world.tileActive[world.tileIndex(tx, ty, c)]) {
+                    continue;
+                }
+                message.tiles.push_back(tx + static_cast<int64_t>(world.tilesX) * c);
+                int32_t xEnd = std::min(world.width, (tx + 1) * ACTIVITY_TILE_SIZE);
+                for (int32_t x = tx * ACTIVITY_TILE_SIZE; x < xEnd; x++) {
+                    message.pheromones.push_back(world.pheromoneGrid.read(x, y, c));
+                }
+            }
+        }
+        return pack(message);
+    };
+    startExchange(haloExchange, packRow(yBegin), packRow(yEnd - 1));
+}
+
+void DomainBackend::receiveHalos(World &world) {
+    auto numColonies = static_cast<int32_t>(world.colonies.size());
+    finishExchange(haloExchange);
+
+    for (const auto &data : {haloExchange.received[1], haloExchange.received[0]}) {
+        if (data.empty()) {
+            continue;
+        }
+        auto message = unpack<HaloMessage>(data);
+        int32_t y = message.y;
+        int32_t ty = y / ACTIVITY_TILE_SIZE;
+        for (int32_t x = 0; x < world.width; x++) {
+            world.foodGrid.publish(x, y, message.food[x]);
+        }
+
+        // tiles that weren't sent are all zero on the owner. we only ever read this one row of the halo
+        // tiles, so the local tile flags here just track which parts of the row might be non-zero.
+        std::vector<uint8_t> received(static_cast<size_t>(world.tilesX) * numColonies);
+        size_t index = 0;
+        for (auto tile : message.tiles) {
+            auto tx = static_cast<int32_t>(tile % world.tilesX);
+            auto c = static_cast<int32_t>(tile / world.tilesX);
+            received[tile] = true;
+            world.tileActive[world.tileIndex(tx, ty, c)] = true;
+            int32_t xEnd = std::min(world.width, (tx + 1) * ACTIVITY_TILE_SIZE);
+            for (int32_t x = tx * ACTIVITY_TILE_SIZE; x < xEnd; x++) {
+                world.pheromoneGrid.publish(x, y, c, message.pheromones[index++]);
+            }
+        }
+        for (int32_t c = 0; c < numColonies; c++) {
+            for (int32_t tx = 0; tx < world.tilesX; tx++) {
+                auto tile = world.tileIndex(tx, ty, c);
+                if (!world.tileActive[tile] || received[tx + static_cast<size_t>(world.tilesX) * c]) {
+                    continue;
+                }
+                int32_t xEnd = std::min(world.width, (tx + 1) * ACTIVITY_TILE_SIZE);
+                for (int32_t x = tx * ACTIVITY_TILE_SIZE; x < xEnd; x++) {
+                    world.pheromoneGrid.publish(x, y, c, PheromoneStrength());
+                }
+                world.tileActive[tile] = false;
+            }
+        }
+    }
+}
+
+bool DomainBackend::update(World &world) {
+    // each rank gets its own stream of random numbers. with one rank, this is the same as the serial update.
+    uint64_t seed = world.rng() + mpiRank;
+    auto colonyAddAnts = world.updateAnts(seed);
+
+    // colony state is replicated on every rank, so sum up the returns and ant counts for each colony
+    // everywhere, then do the same bookkeeping on every rank. the ants are counted before any leave our
+    // strip, which gives the same totals, so this doesn't have to wait for the boundary exchange.
+    size_t numColonies = world.colonies.size();
+    std::vector<int64_t> counts(numColonies * 2);
+    for (auto colony : colonyAddAnts) {
+        counts[colony - world.colonies.data()]++;
+    }
+    for (size_t c = 0; c < numColonies; c++) {
+        counts[numColonies + c] = static_cast<int64_t>(world.colonies[c].ants.size());
+    }
+    sendBoundary(world);
+    MPI_Allreduce(MPI_IN_PLACE, counts.data(), static_cast<int>(counts.size()), MPI_INT64_T, MPI_SUM,
+                  MPI_COMM_WORLD);
+
+    std::vector<size_t> antCounts(numColonies);
+    for (size_t c = 0; c < numColonies; c++) {
+        auto &colony = world.colonies[c];
+        // new ants are spawned in the centre of the colony, so only the rank that owns it spawns them
+        for (int64_t i = 0; i < counts[c]; i++) {
+            world.feedColony(colony, owns(colony.pos.y));
+        }
+        antCounts[c] = counts[numColonies + c] + counts[c] * world.colonyAntsPerTick;
+    }
+    auto antsAlive = world.updateColonyStats(antCounts);
+
+    // commit and decay our strip only. the neighbours' deposits only land in our first and last rows of
+    // tiles, so the rows in between are decayed while they are still on their way.
+    if (tyEnd - tyBegin > 2) {
+        world.decayAndCommitPheromones(tyBegin + 1, tyEnd - 1);
+    }
+    receiveBoundary(world);
+    world.foodGrid.commitRows(yBegin, yEnd);
+    world.decayAndCommitPheromones(tyBegin, tyBegin + 1);
+    if (tyEnd - tyBegin > 1) {
+        world.decayAndCommitPheromones(tyEnd - 1, tyEnd);
+    }
+    for (const auto &pos : foodTakenByNeighbours) {
+        world.recountTileFood(pos.x / ACTIVITY_TILE_SIZE, pos.y / ACTIVITY_TILE_SIZE);
+    }
+
+    // refresh the halos from the neighbours, while the food remaining is summed up
+    sendHalos(world);
+    int32_t foodRemaining = world.countFood(tyBegin, tyEnd);
+    MPI_Request foodRequest{};
+    MPI_Iallreduce(MPI_IN_PLACE, &foodRemaining, 1, MPI_INT32_T, MPI_SUM, MPI_COMM_WORLD, &foodRequest);
+    receiveHalos(world);
+    MPI_Wait(&foodRequest, MPI_STATUS_IGNORE);
+    return world.checkShouldContinue(antsAlive, foodRemaining);
+}
+
+std::vector<uint8_t> DomainBackend::render(const World &world) {
+    // each rank renders the rows of the frame in its own strip, and the master stitches them together. when
+    // the frame is downsampled, an ant is only drawn by its own rank, so one in a block of rows shared with the
+    // strip above may be missed.
+    auto [rowBegin, rowEnd] = world.frameRowsOf(yBegin, yEnd);
+    auto strip = world.renderRows(rowBegin, rowEnd);
+
+    std::vector<uint8_t> out{};
+    std::vector<int> counts{}, displacements{};
+    if (isMaster()) {
+        int32_t frameWidth = world.frameRegion.frameWidth();
+        out.resize(static_cast<size_t>(frameWidth) * world.frameRegion.frameHeight());
+        for (int32_t rank = 0; rank < mpiWorldSize; rank++) {
+            auto [begin, end] = tileRowsOf(rank, world.tilesY);
+            auto [first, last] = world.frameRowsOf(begin * ACTIVITY_TILE_SIZE,
+                                                   std::min(end * ACTIVITY_TILE_SIZE, world.height));
+            counts.push_back(frameWidth * (last - first));
+            displacements.push_back(frameWidth * first);
+        }
+    }
+    MPI_Gatherv(strip.data(), static_cast<int>(strip.size()), MPI_UINT8_T, out.data(), counts.data(),
+                displacements.data(), MPI_UINT8_T, 0, MPI_COMM_WORLD);
+    return out;
+}
@@ -11,7 +11,7 @@
 // can be loaded later.
 // Usage: ./dump_random <seed> <width> <height>
 // Will produce width * height numbers
-// This is used in World::decayPheromones to efficiently generate a huge amount of numbers.
+// This is used in World::decayAndCommitPheromones to efficiently generate a huge amount of numbers.
 
 int main(int argc, char *argv[]) {
     log_set_level(LOG_TRACE);
@@ -0,0 +1,311 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <mpi.h>
+#include "ants/ensemble.h"
+#include "ants/backend.h"
+#include "ants/mpi_backend.h"
+#include "ants/world.h"
+#include "ants/utils.h"
+#include "log/log.h"
+
+using namespace ants;
+
+/// One parameter being swept: config[section][key] takes each of the values in turn
+struct SweepParameter {
+    std::string section;
+    std::string key;
+    std::vector<std::string> values;
+};
+
+/// Summary statistics of one ensemble member. Trivially copyable, so it's sent to rank 0 as plain bytes.
+struct MemberResult {
+    int64_t member{};
+    int64_t seed{};
+    uint64_t ticks{};
+    uint64_t maxAnts{};
+    uint64_t antsAlive{};
+    int64_t foodRemaining{};
+    uint64_t liveColonies{};
+    double simTimeMs{};
+};
+
+/// Reads an optional positive integer from the [Ensemble] section
+static int64_t readEnsembleOption(mINI::INIStructure &config, const std::string &key, int64_t defaultValue) {
+    auto value = config["Ensemble"][key];
+    auto number = value.empty() ? defaultValue : std::stol(value);
+    if (number < 1) {
+        std::ostringstream oss;
+        oss << "[Ensemble] " << key << " must be at least 1, got " << value;
+        throw std::invalid_argument(oss.str());
+    }
+    return number;
+}
+
+/// Splits a comma separated list, trimming spaces around each value
+static std::vector<std::string> splitList(const std::string &list) {
+    std::vector<std::string> values{};
+    std::istringstream stream(list);
+    std::string value;
+    while (std::getline(stream, value, ',')) {
+        auto begin = value.find_first_not_of(" \t");
+        auto end = value.find_last_not_of(" \t");
+        if (begin != std::string::npos) {
+            values.emplace_back(value.substr(begin, end - begin + 1));
+        }
+    }
+    return values;
+}
+
+/// Reads the [Sweep] section: each key is "section.key" of another config value, and each value is the
+/// comma separated list of values to try it with
+static std::vector<SweepParameter> parseSweep(mINI::INIStructure &config) {
+    std::vector<SweepParameter> sweep{};
+    if (!config.has("Sweep")) {
+        return sweep;
+    }
+    for (const auto &[name, list] : config["Sweep"]) {
+        auto dot = name.find('.');
+        if (dot == std::string::npos) {
+            std::ostringstream oss;
+            oss << "Sweep parameter '" << name << "' should be written as section.key";
+            throw std::invalid_argument(oss.str());
+        }
+        SweepParameter parameter{name.substr(0, dot), name.substr(dot + 1), splitList(list)};
+        // catches typos, which would otherwise silently run the same simulation over and over
+        if (!config.has(parameter.section) || !config[parameter.section].has(parameter.key)) {
+            std::ostringstream oss;
+            oss << "Sweep parameter '" << name << "' is not in the config file";
+            throw std::invalid_argument(oss.str());
+        }
+        if (parameter.values.empty()) {
+            std::ostringstream oss;
+            oss << "Sweep parameter '" << name << "' has no values";
+            throw std::invalid_argument(oss.str());
+        }
+        sweep.emplace_back(std::move(parameter));
+    }
+    return sweep;
+}
+
+/// Returns the value of each sweep parameter in the given combination. The last parameter varies fastest.
+static std::vector<std::string> sweepValues(const std::vector<SweepParameter> &sweep, int64_t combination) {
+    std::vector<std::string> values(sweep.size());
+    for (size_t i = sweep.size(); i-- > 0;) {
+        auto count = static_cast<int64_t>(sweep[i].values.size());
+        values[i] = sweep[i].values[combination % count];
+        combination /= count;
+    }
+    return values;
+}
+
+/// Runs one member of the ensemble over the ranks of groupComm, and returns its statistics
+static MemberResult runMember(const mINI::INIStructure &config, const std::vector<SweepParameter> &sweep,
+                              int64_t member, int64_t seeds, int64_t baseSeed, MPI_Comm groupComm,
+                              int32_t groupSize) {
+    MemberResult result{};
+    result.member = member;
+    // every combination of parameters is run with the same seeds, so they can be compared like for like.
+    // pcg64_fast forces the bottom two bits of its state on, so seeds less than 4 apart can be the same.
+    result.seed = baseSeed + 4 * (member % seeds);
+
+    auto memberConfig = config;
+    auto values = sweepValues(sweep, member / seeds);
+    for (size_t i = 0; i < sweep.size(); i++) {
+        memberConfig[sweep[i].section][sweep[i].key] = values[i];
+    }
+    memberConfig["Simulation"]["rng_seed"] = std::to_string(result.seed);
+
+    // the backend is declared before the world, so it's destroyed after it (the hybrid backend's
+    // shared memory window holds the world's grids)
+    std::unique_ptr<Backend> backend{};
+    if (groupSize == 1) {
+        backend = std::make_unique<OmpBackend>();
+    } else {
+        backend = std::make_unique<MpiBackend>(groupComm, true, memberConfig);
+    }
+    if (backend->isMaster()) {
+        log_info("Running ensemble member %ld with seed %ld", member, result.seed);
+    }
+    auto world = World(memberConfig["Simulation"]["grid_file"], memberConfig);
+    backend->attach(world);
+
+    uint32_t numTicks = std::stoi(memberConfig["Simulation"]["simulate_ticks"]);
+    auto simTimeBegin = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < numTicks; i++) {
+        result.ticks++;
+        if (!backend->update(world)) {
+            break;
+        }
+    }
+    auto simTimeEnd = std::chrono::steady_clock::now();
+
+    result.simTimeMs = COUNT_MS(simTimeEnd, simTimeBegin);
+    result.maxAnts = world.maxAnts;
+    result.antsAlive = world.maxAntsLastTick;
+    result.foodRemaining = world.foodLastTick;
+    result.liveColonies = world.countLiveColonies();
+    return result;
+}
+
+/// Writes one row per member to a CSV file named after the current date, and returns its path
+static std::string writeSummary(const std::string &prefix, const std::vector<SweepParameter> &sweep,
+                                int64_t seeds, const std::vector<MemberResult> &results) {
+    auto t = std::time(nullptr);
+    auto tm = *std::localtime(&t);
+    std::ostringstream filename;
+    filename << prefix << std::put_time(&tm, "ensemble_%d-%m-%Y_%H-%M-%S.csv");
+
+    std::ofstream out(filename.str());
+    if (!out) {
+        log_warn("Failed to create ensemble summary %s", filename.str().c_str());
+        return filename.str();
+    }
+    out << "Member,Seed";
+    for (const auto &parameter : sweep) {
+        out << "," << parameter.section << "." << parameter.key;
+    }
+    out << ",Ticks,MaxAnts,AntsAlive,FoodRemaining,LiveColonies,SimTimeMs\n";
+    for (const auto &result : results) {
+        out << result.member << "," << result.seed;
+        for (const auto &value : sweepValues(sweep, result.member / seeds)) {
+            out << "," << value;
+        }
+        out << "," << result.ticks << "," << result.maxAnts << "," << result.antsAlive << ","
+            << result.foodRemaining << "," << result.liveColonies << "," << result.simTimeMs << "\n";
+    }
+    return filename.str();
+}
+
+int ants::runEnsemble(mINI::INIStructure &config, int *argc, char ***argv) {
+    // read the whole sweep first, so a bad config fails before MPI is started
+    auto sweep = parseSweep(config);
+    auto seeds = readEnsembleOption(config, "seeds", 1);
+    auto groupSize = static_cast<int32_t>(readEnsembleOption(config, "group_size", 1));
+    int64_t numMembers = seeds;
+    for (const auto &parameter : sweep) {
+        numMembers *= static_cast<int64_t>(parameter.values.size());
+    }
+
+    // groups of more than one rank use the hybrid backend, which needs thread support
+    initialiseMpi(argc, argv, true);
+    int32_t worldSize{}, worldRank{};
+    MPI_Comm_size(MPI_COMM_WORLD, &worldSize);
+    MPI_Comm_rank(MPI_COMM_WORLD, &worldRank);
+
+    int32_t numGroups = worldSize / groupSize;
+    if (numGroups == 0) {
+        MPI_Finalize();
+        std::ostringstream oss;
+        oss << "[Ensemble] group_size is " << groupSize << ", but there are only " << worldSize << " rank(s)";
+        throw std::invalid_argument(oss.str());
+    }
+    if (worldRank == 0) {
+        log_info("Running an ensemble of %ld member(s) (%zu swept parameter(s), %ld seed(s) each) on %d "
+                 "group(s) of %d rank(s)", numMembers, sweep.size(), seeds, numGroups, groupSize);
+        if (worldSize % groupSize != 0) {
+            log_warn("%d rank(s) don't make up a whole group and will sit idle", worldSize % groupSize);
+        }
+        if (config["Simulation"]["recording_enabled"] == "true") {
+            log_info("Ensemble members are not recorded, only the summary statistics are written");
+        }
+    }
+    int32_t group = worldRank / groupSize;
+    bool idle = group >= numGroups;
+    MPI_Comm groupComm = MPI_COMM_NULL;
+    MPI_Comm_split(MPI_COMM_WORLD, idle ? MPI_UNDEFINED : group, worldRank, &groupComm);
+
+    // members are seeded from rng_seed up, so a random base seed has to be picked once for everyone
+    int64_t baseSeed = std::stol(config["Simulation"]["rng_seed"]);
+    if (baseSeed == 0 && worldRank == 0) {
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        baseSeed = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+    }
+    MPI_Bcast(&baseSeed, 1, MPI_INT64_T, 0, MPI_COMM_WORLD);
+
+    // the number of the next member to run lives on rank 0, and group leaders take members with an atomic
+    // fetch and add. members that die out early finish much sooner than the rest, so handing them out as
+    // groups become free balances the load far better than a fixed split would.
+    int64_t *nextMember = nullptr;
+    MPI_Win counterWindow = MPI_WIN_NULL;
+    MPI_Win_allocate(worldRank == 0 ? sizeof(int64_t) : 0, sizeof(int64_t), MPI_INFO_NULL, MPI_COMM_WORLD,
+                     &nextMember, &counterWindow);
+    if (worldRank == 0) {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, counterWindow);
+        *nextMember = 0;
+        MPI_Win_unlock(0, counterWindow);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    auto wallClockBegin = std::chrono::steady_clock::now();
+    std::vector<MemberResult> results{};
+    if (!idle) {
+        int32_t groupRank{};
+        MPI_Comm_rank(groupComm, &groupRank);
+        while (true) {
+            int64_t member = 0;
+            if (groupRank == 0) {
+                int64_t one = 1;
+                MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, counterWindow);
+                MPI_Fetch_and_op(&one, &member, MPI_INT64_T, 0, 0, MPI_SUM, counterWindow);
+                MPI_Win_unlock(0, counterWindow);
+            }
+            MPI_Bcast(&member, 1, MPI_INT64_T, 0, groupComm);
+            if (member >= numMembers) {
+                break;
+            }
+            auto result = runMember(config, sweep, member, seeds, baseSeed, groupComm, groupSize);
+            if (groupRank == 0) {
+                results.push_back(result);
+            }
+        }
+        MPI_Comm_free(&groupComm);
+    }
+    MPI_Win_free(&counterWindow);
+
+    // gather every group leader's results to rank 0
+    int count = static_cast<int>(results.size() * sizeof(MemberResult));
+    std::vector<int> counts(worldSize), displacements(worldSize);
+    MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    std::vector<MemberResult> allResults{};
+    if (worldRank == 0) {
+        for (int32_t i = 1; i < worldSize; i++) {
+            displacements[i] = displacements[i - 1] + counts[i - 1];
+        }
+        allResults.resize((displacements.back() + counts.back()) / sizeof(MemberResult));
+    }
+    MPI_Gatherv(results.data(), count, MPI_BYTE, allResults.data(), counts.data(), displacements.data(),
+                MPI_BYTE, 0, MPI_COMM_WORLD);
+
+    if (worldRank == 0) {
+        auto wallClockEnd = std::chrono::steady_clock::now();
+        auto wallTimeMs = COUNT_MS(wallClockEnd, wallClockBegin);
+        std::sort(allResults.begin(), allResults.end(), [](const MemberResult &a, const MemberResult &b) {
+            return a.member < b.member;
+        });
+        uint64_t totalTicks = 0;
+        for (const auto &result : allResults) {
+            totalTicks += result.ticks;
+        }
+        auto path = writeSummary(config["Simulation"]["output_prefix"], sweep, seeds, allResults);
+
+        log_info("=============== Ensemble Report ===============");
+        log_info("Members: %zu on %d group(s) of %d rank(s)", allResults.size(), numGroups, groupSize);
+        log_info("Wall time: %.3f ms (%.3f member ticks per second)", wallTimeMs,
+                 static_cast<double>(totalTicks) / (wallTimeMs / 1000.0));
+        log_info("Summary written to %s", path.c_str());
+    }
+
+    MPI_Finalize();
+    return 0;
+}
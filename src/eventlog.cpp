@@ -0,0 +1,307 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <zlib.h>
+#include "ants/eventlog.h"
+#include "ants/utils.h"
+#include "log/log.h"
+
+using namespace ants;
+
+constexpr char ANTLOG_MAGIC[8] = {'A', 'N', 'T', 'L', 'O', 'G', '0', '1'};
+
+/// Event code for a move of (dx, dy), indexed (dx + 1) * 3 + (dy + 1). Same order as directions.
+constexpr uint8_t MOVE_CODES[9] = {0, 1, 2, 3, ANTLOG_STAYED, 4, 5, 6, 7};
+
+static void writeF64(std::vector<uint8_t> &out, double value) {
+    uint64_t bits{};
+    std::memcpy(&bits, &value, sizeof(bits));
+    for (int i = 0; i < 8; i++) {
+        out.push_back(bits >> (8 * i));
+    }
+}
+
+static double readF64(const std::vector<uint8_t> &in, size_t &pos) {
+    if (in.size() - pos < 8) {
+        throw std::runtime_error("Corrupt event log: truncated block");
+    }
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++) {
+        bits |= static_cast<uint64_t>(in[pos++]) << (8 * i);
+    }
+    double value{};
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static uint8_t readU8(const std::vector<uint8_t> &in, size_t &pos) {
+    if (pos >= in.size()) {
+        throw std::runtime_error("Corrupt event log: truncated block");
+    }
+    return in[pos++];
+}
+
+/// Appends one bit per cell of the grid, row by row
+static void writeBitmap(std::vector<uint8_t> &out, const SnapGrid2D<bool> &grid, int32_t width, int32_t height) {
+    uint8_t byte = 0;
+    size_t bit = 0;
+    for (int32_t y = 0; y < height; y++) {
+        for (int32_t x = 0; x < width; x++) {
+            byte |= grid.read(x, y) << (bit % 8);
+            if (++bit % 8 == 0) {
+                out.push_back(byte);
+                byte = 0;
+            }
+        }
+    }
+    if (bit % 8 != 0) {
+        out.push_back(byte);
+    }
+}
+
+/// Reads a bitmap written by writeBitmap into the grid, and commits it
+static void readBitmap(const std::vector<uint8_t> &in, size_t &pos, SnapGrid2D<bool> &grid, int32_t width,
+                       int32_t height) {
+    size_t numCells = static_cast<size_t>(width) * height;
+    if (in.size() - pos < (numCells + 7) / 8) {
+        throw std::runtime_error("Corrupt event log: truncated header");
+    }
+    for (size_t i = 0; i < numCells; i++) {
+        if (in[pos + i / 8] & (1 << (i % 8))) {
+            grid.write(static_cast<int32_t>(i % width), static_cast<int32_t>(i / width), true);
+        }
+    }
+    pos += (numCells + 7) / 8;
+    grid.commit();
+}
+
+std::vector<uint8_t> ants::compressLogBlock(const std::vector<uint8_t> &block) {
+    auto compressedSize = compressBound(block.size());
+    std::vector<uint8_t> compressed(compressedSize);
+    if (compress2(compressed.data(), &compressedSize, block.data(), block.size(), Z_BEST_SPEED) != Z_OK) {
+        throw std::runtime_error("Failed to compress event log block");
+    }
+    std::vector<uint8_t> out{};
+    writeVarint(out, block.size());
+    writeVarint(out, compressedSize);
+    out.insert(out.end(), compressed.begin(), compressed.begin() + static_cast<ptrdiff_t>(compressedSize));
+    return out;
+}
+
+EventLogger::EventLogger(const World &world) : world(world) {
+    for (const auto &colony : world.colonies) {
+        lastAnts.emplace_back(colony.ants);
+        lastDead.push_back(colony.isDead);
+    }
+}
+
+std::vector<uint8_t> EventLogger::encodeHeader() const {
+    std::vector<uint8_t> header{};
+    writeVarint(header, world.width);
+    writeVarint(header, world.height);
+    writeVarint(header, world.colonies.size());
+    writeF64(header, world.pheromoneDecayFactor);
+    writeF64(header, world.pheromoneFuzzFactor);
+    writeF64(header, world.pheromoneGainFactor);
+    writeVarint(header, crc32(world.randomBuffer.data(), world.randomBuffer.size() * sizeof(double)));
+    writeBitmap(header, world.foodGrid, world.width, world.height);
+    writeBitmap(header, world.obstacleGrid, world.width, world.height);
+    for (const auto &colony : world.colonies) {
+        header.push_back(colony.colour.r);
+        header.push_back(colony.colour.g);
+        header.push_back(colony.colour.b);
+        writeVarint(header, colony.pos.x);
+        writeVarint(header, colony.pos.y);
+        writeVarint(header, colony.ants.size());
+        writeF64(header, colony.hunger);
+    }
+
+    std::vector<uint8_t> out(ANTLOG_MAGIC, ANTLOG_MAGIC + sizeof(ANTLOG_MAGIC));
+    auto block = compressLogBlock(header);
+    out.insert(out.end(), block.begin(), block.end());
+    return out;
+}
+
+std::vector<uint8_t> EventLogger::logTick() {
+    std::vector<uint8_t> out{};
+    for (size_t c = 0; c < world.colonies.size(); c++) {
+        const auto &colony = world.colonies[c];
+        auto &last = lastAnts[c];
+        // dead colonies aren't updated, so there's nothing to log for them
+        if (!lastDead[c]) {
+            for (size_t a = 0; a < last.size(); a++) {
+                if (last[a].isDead) {
+                    continue;
+                }
+                const auto &ant = colony.ants[a];
+                int32_t dx = ant.x - last[a].x;
+                int32_t dy = ant.y - last[a].y;
+                if (std::abs(dx) > 1 || std::abs(dy) > 1) {
+                    throw std::logic_error("Ant moved more than one cell in a tick, can't log it");
+                }
+                uint8_t event = MOVE_CODES[(dx + 1) * 3 + (dy + 1)];
+                if (ant.holdingFood != last[a].holdingFood) {
+                    event |= ANTLOG_TOGGLED_FOOD;
+                }
+                if (ant.isDead) {
+                    event |= ANTLOG_DIED;
+                }
+                out.push_back(event);
+                last[a] = ant;
+            }
+            // new ants are always added to the end
+            writeVarint(out, colony.ants.size() - last.size());
+            last.insert(last.end(), colony.ants.begin() + static_cast<ptrdiff_t>(last.size()), colony.ants.end());
+        }
+        lastDead[c] = colony.isDead;
+    }
+    for (const auto &colony : world.colonies) {
+        out.push_back(colony.isDead);
+        writeF64(out, colony.hunger);
+    }
+    return out;
+}
+
+EventReplay::EventReplay(const std::string &path) {
+    file.reset(fopen(path.c_str(), "rb"));
+    if (file == nullptr) {
+        std::ostringstream oss;
+        oss << "Failed to open event log " << path << ": " << strerror(errno);
+        throw std::runtime_error(oss.str());
+    }
+    char magic[sizeof(ANTLOG_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), file.get()) != sizeof(magic) || memcmp(magic, ANTLOG_MAGIC, sizeof(magic)) != 0
+        || !readBlock(block)) {
+        std::ostringstream oss;
+        oss << path << " is not an event log";
+        throw std::runtime_error(oss.str());
+    }
+
+    size_t pos = 0;
+    world.width = static_cast<int32_t>(readVarint(block, pos));
+    world.height = static_cast<int32_t>(readVarint(block, pos));
+    auto numColonies = static_cast<int32_t>(readVarint(block, pos));
+    world.pheromoneDecayFactor = readF64(block, pos);
+    world.pheromoneFuzzFactor = readF64(block, pos);
+    world.pheromoneGainFactor = readF64(block, pos);
+    auto randomCrc = readVarint(block, pos);
+
+    world.randomBuffer = World::loadRandomBuffer(static_cast<size_t>(world.width) * world.height);
+    if (crc32(world.randomBuffer.data(), world.randomBuffer.size() * sizeof(double)) != randomCrc) {
+        throw std::runtime_error("random.bin is not the one the event log was recorded with");
+    }
+
+    world.foodGrid = SnapGrid2D<bool>(world.width, world.height, HugePageMode::NONE);
+    world.obstacleGrid = SnapGrid2D<bool>(world.width, world.height, HugePageMode::NONE);
+    readBitmap(block, pos, world.foodGrid, world.width, world.height);
+    readBitmap(block, pos, world.obstacleGrid, world.width, world.height);
+
+    for (int32_t c = 0; c < numColonies; c++) {
+        Colony colony{};
+        colony.id = c;
+        colony.colour.r = readU8(block, pos);
+        colony.colour.g = readU8(block, pos);
+        colony.colour.b = readU8(block, pos);
+        colony.pos.x = static_cast<int32_t>(readVarint(block, pos));
+        colony.pos.y = static_cast<int32_t>(readVarint(block, pos));
+        // only the ants are needed to render, not their AntMeta
+        Ant ant{};
+        ant.setPos(colony.pos.x, colony.pos.y);
+        colony.ants.assign(readVarint(block, pos), ant);
+        colony.hunger = readF64(block, pos);
+        world.colonies.emplace_back(colony);
+    }
+    world.pheromoneGrid = SnapGrid3D<PheromoneStrength>(world.width, world.height, numColonies,
+                                                        HugePageMode::NONE);
+    world.buildPalette();
+    world.tilesX = (world.width + ACTIVITY_TILE_SIZE - 1) / ACTIVITY_TILE_SIZE;
+    world.tilesY = (world.height + ACTIVITY_TILE_SIZE - 1) / ACTIVITY_TILE_SIZE;
+    world.tileActive = GridBuffer<uint8_t>(world.tilesX, world.tilesY, numColonies, HugePageMode::NONE);
+    world.trackRenderIntensity();
+    world.setFrameRegion({});
+    log_info("Event log %s is %dx%d, with %d colonies", path.c_str(), world.width, world.height, numColonies);
+}
+
+bool EventReplay::readBlock(std::vector<uint8_t> &out) {
+    uint64_t size = 0, compressedSize = 0;
+    if (!readVarint(file.get(), size)) {
+        return false;
+    }
+    if (!readVarint(file.get(), compressedSize)) {
+        throw std::runtime_error("Corrupt event log: truncated block");
+    }
+    compressed.resize(compressedSize);
+    out.resize(size);
+    uLongf decompressedSize = size;
+    if (fread(compressed.data(), 1, compressedSize, file.get()) != compressedSize ||
+        uncompress(out.data(), &decompressedSize, compressed.data(), compressedSize) != Z_OK ||
+        decompressedSize != size) {
+        throw std::runtime_error("Corrupt event log: bad block data");
+    }
+    return true;
+}
+
+bool EventReplay::nextTick() {
+    if (!readBlock(block)) {
+        return false;
+    }
+
+    // the same steps, in the same order, as World::updateAnt and World::finishTick
+    size_t pos = 0;
+    for (auto &colony : world.colonies) {
+        if (colony.isDead) {
+            continue;
+        }
+        auto c = static_cast<int32_t>(colony.id);
+        for (auto &ant : colony.ants) {
+            if (ant.isDead) {
+                continue;
+            }
+            auto event = readU8(block, pos);
+            auto move = event & 0xF;
+            if (move != ANTLOG_STAYED) {
+                if (move >= 8) {
+                    throw std::runtime_error("Corrupt event log: bad ant move");
+                }
+                int32_t x = ant.x + directions[move].x;
+                int32_t y = ant.y + directions[move].y;
+                if (x < 0 || y < 0 || x >= world.width || y >= world.height) {
+                    throw std::runtime_error("Corrupt event log: ant moved off the map");
+                }
+                ant.setPos(x, y);
+            }
+            // pheromone goes down before the ant picks up or drops off food
+            world.depositPheromone(ant, c);
+            if (event & ANTLOG_TOGGLED_FOOD) {
+                ant.holdingFood = !ant.holdingFood;
+                if (ant.holdingFood) {
+                    world.foodGrid.write(ant.x, ant.y, false);
+                }
+            }
+            if (event & ANTLOG_DIED) {
+                ant.isDead = true;
+            }
+        }
+        Ant spawned{};
+        spawned.setPos(colony.pos.x, colony.pos.y);
+        colony.ants.insert(colony.ants.end(), readVarint(block, pos), spawned);
+    }
+    for (auto &colony : world.colonies) {
+        colony.isDead = readU8(block, pos) != 0;
+        colony.hunger = readF64(block, pos);
+    }
+
+    world.foodGrid.commit();
+    world.decayAndCommitPheromones(0, world.tilesY);
+    return true;
+}
+
+std::vector<uint8_t> EventReplay::renderRows(int32_t yBegin, int32_t yEnd) const {
+    return world.renderRows(yBegin, yEnd);
+}
@@ -0,0 +1,294 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define ANTS_IO_URING
+#endif
+#include "ants/filewriter.h"
+#include "log/log.h"
+
+using namespace ants;
+
+AsyncFileWriter::AsyncFileWriter(const std::string &path) : path(path) {
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        // errno is left for the caller to report
+        return;
+    }
+    buffers.resize(WRITE_BUFFERS);
+    for (auto &buffer : buffers) {
+        void *ptr = nullptr;
+        if (posix_memalign(&ptr, WRITE_BUFFER_ALIGNMENT, WRITE_BUFFER_BYTES) != 0) {
+            throw std::bad_alloc();
+        }
+        buffer.data = static_cast<uint8_t *>(ptr);
+    }
+    if (setupRing()) {
+        log_debug("Writing %s through io_uring", path.c_str());
+    } else {
+        log_debug("io_uring isn't available, writing %s with pwrite", path.c_str());
+    }
+}
+
+AsyncFileWriter::~AsyncFileWriter() {
+    close();
+    for (auto &buffer : buffers) {
+        free(buffer.data);
+    }
+}
+
+bool AsyncFileWriter::write(const void *data, size_t len) {
+    if (fd == -1) {
+        return false;
+    }
+    auto *bytes = static_cast<const uint8_t *>(data);
+    while (len > 0) {
+        auto &buffer = buffers[current];
+        auto n = std::min(len, WRITE_BUFFER_BYTES - buffer.used);
+        memcpy(buffer.data + buffer.used, bytes, n);
+        buffer.used += n;
+        bytes += n;
+        len -= n;
+        if (buffer.used == WRITE_BUFFER_BYTES) {
+            submitCurrent();
+        }
+    }
+    return !failed;
+}
+
+bool AsyncFileWriter::close() {
+    if (fd == -1) {
+        return !failed;
+    }
+    if (buffers[current].used > 0) {
+        submitCurrent();
+    }
+    while (numInFlight > 0) {
+        waitForCompletion();
+    }
+    teardownRing();
+    if (::close(fd) != 0) {
+        log_warn("Failed to close %s: %s", path.c_str(), strerror(errno));
+        failed = true;
+    }
+    fd = -1;
+    log_debug("Wrote %lu bytes to %s", nextOffset, path.c_str());
+    return !failed;
+}
+
+void AsyncFileWriter::submitCurrent() {
+    auto &buffer = buffers[current];
+    buffer.offset = nextOffset;
+    nextOffset += buffer.used;
+
+    bool submitted = false;
+#ifdef ANTS_IO_URING
+    if (ringFd != -1 && !ringBroken) {
+        // we're the only one submitting, so the tail can be read plainly, but the kernel must see the entry
+        // before the new tail
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        auto &sqe = static_cast<io_uring_sqe *>(sqes)[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_WRITE;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer.data);
+        sqe.len = static_cast<uint32_t>(buffer.used);
+        sqe.off = buffer.offset;
+        sqe.user_data = current;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        long res;
+        do {
+            res = syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, nullptr, 0);
+        } while (res < 0 && errno == EINTR);
+        if (res == 1) {
+            buffer.inFlight = true;
+            numInFlight++;
+            submitted = true;
+        } else {
+            // nothing was taken from the ring (there's no kernel polling thread), so take the entry back
+            log_warn("io_uring submit for %s failed (%s), writing with pwrite instead", path.c_str(),
+                     res < 0 ? strerror(errno) : "not consumed");
+            __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+            ringBroken = true;
+        }
+    }
+#endif
+    if (!submitted) {
+        finishWithPwrite(buffer, 0);
+    }
+
+    // buffers are used in turn, so the next one was submitted before any other still in flight
+    current = (current + 1) % buffers.size();
+    while (buffers[current].inFlight) {
+        waitForCompletion();
+    }
+    buffers[current].used = 0;
+}
+
+void AsyncFileWriter::finishWithPwrite(Buffer &buffer, size_t done) {
+    while (done < buffer.used && !failed) {
+        auto n = pwrite(fd, buffer.data + done, buffer.used - done, static_cast<off_t>(buffer.offset + done));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_warn("Failed to write %s: %s", path.c_str(), strerror(errno));
+            failed = true;
+        } else {
+            done += n;
+        }
+    }
+    buffer.inFlight = false;
+}
+
+bool AsyncFileWriter::setupRing() {
+#ifdef ANTS_IO_URING
+    io_uring_params params{};
+    auto ring = static_cast<int>(syscall(__NR_io_uring_setup, static_cast<unsigned>(WRITE_BUFFERS), &params));
+    if (ring < 0) {
+        return false;
+    }
+    ringFd = ring;
+    sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        sqRingBytes = cqRingBytes = std::max(sqRingBytes, cqRingBytes);
+    }
+    sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+
+    auto map = [&](size_t bytes, off_t offset) -> void * {
+        void *ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    };
+    sqRing = map(sqRingBytes, IORING_OFF_SQ_RING);
+    cqRing = singleMap ? sqRing : map(cqRingBytes, IORING_OFF_CQ_RING);
+    sqes = map(sqesBytes, IORING_OFF_SQES);
+    if (sqRing == nullptr || cqRing == nullptr || sqes == nullptr) {
+        teardownRing();
+        return false;
+    }
+
+    auto *sq = static_cast<uint8_t *>(sqRing);
+    sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    auto *cq = static_cast<uint8_t *>(cqRing);
+    cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void AsyncFileWriter::teardownRing() {
+    if (ringFd == -1) {
+        return;
+    }
+    if (sqes != nullptr) {
+        munmap(sqes, sqesBytes);
+    }
+    if (cqRing != nullptr && cqRing != sqRing) {
+        munmap(cqRing, cqRingBytes);
+    }
+    if (sqRing != nullptr) {
+        munmap(sqRing, sqRingBytes);
+    }
+    sqRing = cqRing = sqes = nullptr;
+    ::close(ringFd);
+    ringFd = -1;
+}
+
+void AsyncFileWriter::waitForCompletion() {
+#ifdef ANTS_IO_URING
+    while (true) {
+        // we're the only one reaping, so the head can be read plainly, but the completion must be read after
+        // the tail that covers it
+        unsigned head = *cqHead;
+        if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+            const auto &cqe = static_cast<io_uring_cqe *>(cqes)[head & *cqMask];
+            auto &buffer = buffers[cqe.user_data];
+            int res = cqe.res;
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+            numInFlight--;
+            if (res < 0) {
+                // e.g. a kernel too old for IORING_OP_WRITE
+                log_warn("io_uring write to %s failed (%s), writing with pwrite instead", path.c_str(),
+                         strerror(-res));
+                ringBroken = true;
+                res = 0;
+            }
+            // also finishes off short writes
+            finishWithPwrite(buffer, static_cast<size_t>(res));
+            return;
+        }
+        if (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) {
+            // we can't tell which writes finished, but writing the same data to the same place again is harmless
+            log_warn("Waiting on io_uring for %s failed (%s), writing with pwrite instead", path.c_str(),
+                     strerror(errno));
+            ringBroken = true;
+            for (auto &buffer : buffers) {
+                if (buffer.inFlight) {
+                    finishWithPwrite(buffer, 0);
+                }
+            }
+            numInFlight = 0;
+            return;
+        }
+    }
+#endif
+}
+
+static int asyncWrite(mtar_t *tar, const void *data, unsigned size) {
+    return static_cast<AsyncFileWriter *>(tar->stream)->write(data, size) ? MTAR_ESUCCESS : MTAR_EWRITEFAIL;
+}
+
+static int asyncRead(mtar_t *tar, void *data, unsigned size) {
+    return MTAR_EREADFAIL;
+}
+
+static int asyncSeek(mtar_t *tar, unsigned offset) {
+    // microtar never seeks while writing
+    return MTAR_ESEEKFAIL;
+}
+
+static int asyncClose(mtar_t *tar) {
+    auto *writer = static_cast<AsyncFileWriter *>(tar->stream);
+    bool ok = writer->close();
+    delete writer;
+    tar->stream = nullptr;
+    return ok ? MTAR_ESUCCESS : MTAR_EWRITEFAIL;
+}
+
+int ants::mtarOpenAsync(mtar_t *tar, const std::string &path) {
+    memset(tar, 0, sizeof(*tar));
+    auto writer = std::make_unique<AsyncFileWriter>(path);
+    if (!writer->isOpen()) {
+        return MTAR_EOPENFAIL;
+    }
+    tar->write = asyncWrite;
+    tar->read = asyncRead;
+    tar->seek = asyncSeek;
+    tar->close = asyncClose;
+    tar->stream = writer.release();
+    return MTAR_ESUCCESS;
+}
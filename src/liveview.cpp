@@ -0,0 +1,103 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "ants/liveview.h"
+#include "log/log.h"
+
+using namespace ants;
+
+/// The header takes one page, and the slots start on the next
+constexpr size_t LIVEVIEW_HEADER_BYTES = 4096;
+/// Slots are padded to a whole number of cache lines
+constexpr size_t LIVEVIEW_SLOT_ALIGNMENT = 64;
+
+LiveFrameRing::LiveFrameRing(const std::string &name, int32_t width, int32_t height, int32_t numSlots,
+                             const std::vector<RGBColour> &palette)
+    : name(name[0] == '/' ? name : "/" + name), width(width), height(height), numSlots(numSlots) {
+    slotsOffset = LIVEVIEW_HEADER_BYTES;
+    auto pixels = static_cast<size_t>(width) * height;
+    slotBytes = (LIVEVIEW_PIXELS_OFFSET + pixels + LIVEVIEW_SLOT_ALIGNMENT - 1) / LIVEVIEW_SLOT_ALIGNMENT *
+                LIVEVIEW_SLOT_ALIGNMENT;
+    mappingBytes = slotsOffset + slotBytes * numSlots;
+
+    // a viewer still mapping the last run's ring keeps it, and can tell this one is new by its inode
+    shm_unlink(this->name.c_str());
+    int fd = shm_open(this->name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1) {
+        log_warn("Failed to create live view %s: %s", this->name.c_str(), strerror(errno));
+        return;
+    }
+    if (ftruncate(fd, static_cast<off_t>(mappingBytes)) != 0) {
+        log_warn("Failed to size live view %s: %s", this->name.c_str(), strerror(errno));
+        close(fd);
+        shm_unlink(this->name.c_str());
+        return;
+    }
+    void *ptr = mmap(nullptr, mappingBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // the mapping keeps the shared memory open
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        log_warn("Failed to map live view %s: %s", this->name.c_str(), strerror(errno));
+        shm_unlink(this->name.c_str());
+        return;
+    }
+    mapping = static_cast<uint8_t *>(ptr);
+
+    // the new shared memory is zeroed, so latest, finished and every slot's sequence start at 0
+    auto put32 = [&](size_t offset, uint32_t value) { memcpy(mapping + offset, &value, sizeof(value)); };
+    auto put64 = [&](size_t offset, uint64_t value) { memcpy(mapping + offset, &value, sizeof(value)); };
+    put32(8, width);
+    put32(12, height);
+    put32(16, numSlots);
+    put32(20, palette.size());
+    put64(24, slotsOffset);
+    put64(32, slotBytes);
+    for (size_t i = 0; i < palette.size(); i++) {
+        auto *entry = mapping + LIVEVIEW_PALETTE_OFFSET + i * 3;
+        entry[0] = palette[i].r;
+        entry[1] = palette[i].g;
+        entry[2] = palette[i].b;
+    }
+    // the magic goes in last, so a viewer that finds it can trust the rest of the header
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(mapping, "ANTLIVE1", 8);
+    log_info("Publishing %dx%d live view frames to %s (%d slots, %.2f MiB)", width, height, this->name.c_str(),
+             numSlots, static_cast<double>(mappingBytes) / BYTES2MIB);
+}
+
+LiveFrameRing::~LiveFrameRing() {
+    if (mapping == nullptr) {
+        return;
+    }
+    __atomic_store_n(reinterpret_cast<uint64_t *>(mapping + LIVEVIEW_FINISHED_OFFSET), 1, __ATOMIC_RELEASE);
+    munmap(mapping, mappingBytes);
+    shm_unlink(name.c_str());
+}
+
+void LiveFrameRing::publish(int64_t tick, const std::vector<uint8_t> &frame) {
+    if (mapping == nullptr) {
+        return;
+    }
+    auto *slot = mapping + slotsOffset + slotBytes * (numPublished % numSlots);
+    auto *sequence = reinterpret_cast<uint64_t *>(slot);
+
+    // seqlock write: readers see the sequence go to 0 before any of the pixels change, and the new sequence
+    // only after all of them have
+    __atomic_store_n(sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(slot + 8, &tick, sizeof(tick));
+    memcpy(slot + LIVEVIEW_PIXELS_OFFSET, frame.data(),
+           std::min(frame.size(), static_cast<size_t>(width) * height));
+    numPublished++;
+    __atomic_store_n(sequence, numPublished, __ATOMIC_RELEASE);
+    __atomic_store_n(reinterpret_cast<uint64_t *>(mapping + LIVEVIEW_LATEST_OFFSET), numPublished,
+                     __ATOMIC_RELEASE);
+}
@@ -9,65 +9,33 @@
 #include <chrono>
 #include <thread>
 #include <utility>
-#include <omp.h>
 #include "ants/world.h"
+#include "ants/backend.h"
+#include "ants/ensemble.h"
+#include "ants/recorder.h"
+#include "ants/liveview.h"
 #include "mini/ini.h"
 #include "log/log.h"
 #include "ants/utils.h"
-#include "stb/stb_image_write.h"
-#include "ants/defines.h"
-#include <mpi.h>
-
-/// Counts the time in milliseconds between end and begin as a double. The time is counted as nanoseconds
-/// for accuracy, then converted as a double to milliseconds.
-#define COUNT_MS(end, begin) static_cast<double>( \
-    std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()) / 1e6
 
 using namespace ants;
 
-/// Used for stbi image write, as the context parameter
-struct ImageContext {
-    std::string filename;
-    World &world;
-    ImageContext(std::string filename, World &world) : filename(std::move(filename)), world(world) {}
-};
-
-// for stbi_write
-// the context pointer is the world instance
-static void writeFunc(void *context, void *data, int size) {
-    auto imageContext = static_cast<ImageContext*>(context);
-    imageContext->world.writeToTar(imageContext->filename, static_cast<uint8_t *>(data), size);
-}
-
 // TODO intercept CTRL+C and write out the recording
 
 int main(int argc, char *argv[]) {
     log_set_level(LOG_DEBUG);
     log_info("COSC3500 Ant Simulator - Matt Young, 2022");
 
-    // ugly preprocessor macros begin here - sorry
-
-    // initialise OpenMP
-#if USE_OMP
-#pragma omp parallel default(none)
-    {
-#pragma omp master
-        log_info("Using OpenMP ant update with %d thread(s)", omp_get_num_threads());
-    }
-#endif
-#if USE_MPI
-    log_info("Using MPI ant update. Number of workers will be determined shortly.");
-    MPI_Init(&argc, &argv);
-#endif
-#if !USE_OMP && !USE_MPI
-    log_info("Using serial ant update");
-#endif
     // load config file from disk
     std::string configPath = "antconfig.ini";
-    if (argc == 2) {
+    std::string backendName{};
+    if (argc >= 2) {
         configPath = std::string(argv[1]);
-    } else if (argc > 2) {
-        throw std::invalid_argument("Usage: ./ant_colony [config_path]");
+    }
+    if (argc == 3) {
+        backendName = std::string(argv[2]);
+    } else if (argc > 3) {
+        throw std::invalid_argument("Usage: ./ant_colony [config_path] [serial|omp|mpi|hybrid|domain|ensemble]");
     }
     log_debug("Loading config file from %s", configPath.c_str());
     mINI::INIFile configFile(configPath);
@@ -76,27 +44,72 @@ int main(int argc, char *argv[]) {
         throw std::runtime_error("Failed to load antconfig.ini, check your working dir");
     }
 
+    // select the update backend: the command line overrides the config file, which defaults to OpenMP
+    if (backendName.empty()) {
+        backendName = config["Simulation"]["backend"];
+    }
+    if (backendName.empty()) {
+        backendName = "omp";
+    }
+    // the ensemble runs many worlds rather than one, so it drives them itself instead of being a backend
+    if (backendName == "ensemble") {
+        return runEnsemble(config, &argc, &argv);
+    }
+    // note that the backend is declared before the world, so it's destroyed after it (MPI must still
+    // be initialised when the world is freed)
+    auto backend = createBackend(backendName, config, &argc, &argv);
+
     // load the world into memory
     auto world = World(config["Simulation"]["grid_file"], config);
+    // every process renders (some MPI backends render in parallel) the same ticks and region of the world, from
+    // pheromone colours that are kept up to date as the pheromones decay. that has to be set up before the
+    // backend shares the grids.
+    bool recordingRequested = config["Simulation"]["recording_enabled"] == "true";
+    RecordingSettings recordingSettings(config);
+    // frames are rendered to be recorded (except in the events format), and for the live view
+    bool renderingEnabled = (recordingRequested && recordingSettings.format != RecordingFormat::EVENTS) ||
+                            !recordingSettings.liveViewName.empty();
+    if (renderingEnabled) {
+        world.setFrameRegion(recordingSettings.region);
+        world.trackRenderIntensity();
+    }
+    backend->attach(world);
 
-    // setup recording
+    // setup recording. only the master records
     bool recordingEnabled;
-#if USE_MPI
-    // in MPI, only the master should record
-    if (world.mpiRank == 0) {
-#endif
-    recordingEnabled = config["Simulation"]["recording_enabled"] == "true";
-    if (recordingEnabled) {
-        world.setupRecording(config["Simulation"]["output_prefix"]);
-    } else {
-        log_debug("PNG TAR recording disabled");
-    }
-#if USE_MPI
+    // in the events format, the master logs what happened each tick instead of rendering it
+    bool loggingEvents = false;
+    std::unique_ptr<Recorder> recorder{};
+    // the master also publishes the frames it renders to the live view, if there is one
+    std::unique_ptr<LiveFrameRing> liveView{};
+    if (backend->isMaster()) {
+        recordingEnabled = recordingRequested;
+        if (recordingEnabled) {
+            loggingEvents = recordingSettings.format == RecordingFormat::EVENTS;
+            std::string name = backend->name();
+            if (loggingEvents && name != "serial" && name != "omp") {
+                // the log follows ants by their index in the colony, which changes as ants move between ranks
+                throw std::invalid_argument("recording_format = events needs the serial or omp backend");
+            }
+            world.setupRecording(config["Simulation"]["output_prefix"]);
+            // frames are encoded and written while the simulation runs, so only the queue is held in memory
+            recorder = std::make_unique<Recorder>(world, recordingSettings);
+        } else {
+            log_debug("PNG TAR recording disabled");
+        }
+        if (!recordingSettings.liveViewName.empty()) {
+            liveView = std::make_unique<LiveFrameRing>(recordingSettings.liveViewName, world.frameRegion.frameWidth(),
+                                                       world.frameRegion.frameHeight(),
+                                                       recordingSettings.liveViewSlots, world.palette.colours());
+            if (!liveView->isOpen()) {
+                liveView.reset();
+            }
+        }
     } else {
+        // in MPI, only the master should record
         log_debug("Not MPI master, so not going to record");
         recordingEnabled = false;
     }
-#endif
 
     // run the simulation for a fixed number of ticks
     uint32_t numTicks = std::stoi(config["Simulation"]["simulate_ticks"]);
@@ -104,9 +117,6 @@ int main(int argc, char *argv[]) {
     double simTimeMs = 0;
     log_info("Now running simulation for %u ticks", numTicks);
 
-    // buffer of uncompressed pixels that need to be turned into PNGs and written to disk
-    std::vector<std::vector<uint8_t>> images{};
-    images.reserve(numTicks);
     std::ostringstream antTimeData;
     antTimeData << "NumAnts,TimeMs\n";
 
@@ -115,23 +125,24 @@ int main(int argc, char *argv[]) {
         log_debug("Iteration %u", i);
 
         auto simTimeBegin = std::chrono::steady_clock::now();
-#if USE_MPI
-        bool shouldContinue = world.updateMpi();
-#else
-        bool shouldContinue = world.update();
-#endif
+        bool shouldContinue = backend->update(world);
         auto simTimeEnd = std::chrono::steady_clock::now();
         simTimeMs += COUNT_MS(simTimeEnd, simTimeBegin);
         antTimeData << world.maxAntsLastTick << "," << COUNT_MS(simTimeEnd, simTimeBegin) << "\n";
 
-#if USE_MPI
-        // sync up everyone after each loop
-        MPI_Barrier(MPI_COMM_WORLD);
-#endif
-
-        // render world and add to uncompressed queue
-        if (recordingEnabled) {
-            images.emplace_back(world.renderWorldUncompressed());
+        // render world, publish it to the live view (which never waits for the viewer), and queue it for
+        // encoding (which waits if the encoders have fallen too far behind)
+        if (loggingEvents) {
+            recorder->logEvents();
+        }
+        if (renderingEnabled && recordingSettings.recordsTick(i)) {
+            auto image = backend->render(world);
+            if (liveView != nullptr) {
+                liveView->publish(i, image);
+            }
+            if (recordingEnabled && !loggingEvents) {
+                recorder->push(std::move(image), i);
+            }
         }
 
         // check early exit
@@ -142,30 +153,16 @@ int main(int argc, char *argv[]) {
     }
     // end simulation update loop
 
-    // after the simulation:
-    // go over each uncompressed image and compress it to the TAR file
+    // after the simulation: wait for the last frames to be encoded and written to the TAR file
     if (recordingEnabled) {
-        size_t totalBytes = 0;
-        log_info("Finalising PNG output (%zu images)", images.size());
-        for (size_t i = 0; i < images.size(); i++) {
-            auto image = images[i];
-            totalBytes += image.size();
-
-            // generate the filename and context for stb image write
-            std::ostringstream ostream;
-            ostream << i << ".png";
-            ImageContext context(ostream.str(), world);
-
-            // encode the png
-            int w = static_cast<int>(world.width);
-            int h = static_cast<int>(world.height);
-            // source: https://solarianprogrammer.com/2019/06/10/c-programming-reading-writing-images-stb_image-libraries/
-            stbi_write_png_to_func(writeFunc, &context, w, h, 3, image.data(), w * 3);
-        }
-        log_debug("Uncompressed image RAM usage was %zu MiB", totalBytes / BYTES2MIB);
+        log_info("Finalising PNG output (%zu images)", recorder->numFrames());
+        recorder->finish();
+        log_debug("Peak queued image RAM usage was %zu MiB", recorder->peakBytes() / BYTES2MIB);
     } else {
         log_debug("Not finalising PNG output because recording was not enabled");
     }
+    // tells the viewer there won't be any more frames
+    liveView.reset();
     log_info("Simulation done!");
 
     // record times
@@ -174,29 +171,22 @@ int main(int argc, char *argv[]) {
     auto wallFps = static_cast<double>(numTicks) / (static_cast<double>(wallTimeMs) / 1000.0);
     auto simFps = static_cast<double>(numTicks) / (static_cast<double>(simTimeMs) / 1000.0);
 
-#if USE_MPI
-    // if in MPI mode, the below code should only be run by the master (it's recording related)
-    if (world.mpiRank == 0) {
-#endif
-    // finalise recording
-    world.writeRecordingStatistics(numTicks, TimeInfo(wallTimeMs, wallFps),
-                                   TimeInfo(simTimeMs, simFps));
-    std::string antTime = antTimeData.str();
-    world.writeToTar("ants_vs_time.csv", (uint8_t *) antTime.c_str(), antTime.size());
-    world.finaliseRecording();
-
-    log_info("=============== Timing Report ===============");
-    log_info("Wall time: %.3f ms (%.3f ticks per second)", wallTimeMs, wallFps);
-    log_info("Sim time: %.3f ms (%.3f ticks per second)", simTimeMs, simFps);
-    auto nonSim = wallTimeMs - simTimeMs;
-    log_info("Time spent in non-simulator tasks: %.3f ms (%.3f%%)", nonSim, (nonSim / wallTimeMs) * 100.0);
-
-#if USE_MPI
-    // quick way to
+    // in MPI mode, the below code should only be run by the master (it's recording related)
+    if (backend->isMaster()) {
+        // finalise recording
+        world.writeRecordingStatistics(numTicks, TimeInfo(wallTimeMs, wallFps),
+                                       TimeInfo(simTimeMs, simFps));
+        std::string antTime = antTimeData.str();
+        world.writeToTar("ants_vs_time.csv", (uint8_t *) antTime.c_str(), antTime.size());
+        world.finaliseRecording();
+
+        log_info("=============== Timing Report ===============");
+        log_info("Backend: %s", backend->name());
+        log_info("Wall time: %.3f ms (%.3f ticks per second)", wallTimeMs, wallFps);
+        log_info("Sim time: %.3f ms (%.3f ticks per second)", simTimeMs, simFps);
+        auto nonSim = wallTimeMs - simTimeMs;
+        log_info("Time spent in non-simulator tasks: %.3f ms (%.3f%%)", nonSim, (nonSim / wallTimeMs) * 100.0);
     }
 
-    MPI_Finalize();
-#endif
-
     return 0;
 }
\ No newline at end of file
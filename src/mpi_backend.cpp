@@ -0,0 +1,584 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <mpi.h>
+#include <omp.h>
+#include "ants/mpi_backend.h"
+#include "ants/world.h"
+#include "log/log.h"
+
+using namespace ants;
+
+void ants::initialiseMpi(int *argc, char ***argv, bool threaded) {
+    if (!threaded) {
+        MPI_Init(argc, argv);
+        return;
+    }
+    // only the main thread of each rank ever makes MPI calls, all of them outside of OpenMP parallel
+    // regions
+    int provided = MPI_THREAD_SINGLE;
+    MPI_Init_thread(argc, argv, MPI_THREAD_FUNNELED, &provided);
+    if (provided < MPI_THREAD_FUNNELED) {
+        MPI_Finalize();
+        throw std::runtime_error("MPI implementation does not support MPI_THREAD_FUNNELED, which is "
+                                 "required for OpenMP threads inside MPI ranks");
+    }
+}
+
+MpiBackend::MpiBackend(int *argc, char ***argv, bool hybrid, mINI::INIStructure &config)
+    : hybrid(hybrid), ownsMpi(true) {
+    if (hybrid) {
+        log_info("Using hybrid MPI + OpenMP ant update. Number of workers will be determined shortly.");
+    } else {
+        log_info("Using MPI ant update. Number of workers will be determined shortly.");
+    }
+    initialiseMpi(argc, argv, hybrid);
+    setup(config);
+}
+
+MpiBackend::MpiBackend(MPI_Comm comm, bool hybrid, mINI::INIStructure &config) : hybrid(hybrid), comm(comm) {
+    setup(config);
+}
+
+void MpiBackend::setup(mINI::INIStructure &config) {
+    MPI_Comm_size(comm, &mpiWorldSize);
+    MPI_Comm_rank(comm, &mpiRank);
+    log_info("MPI world size: %d, my rank: %d", mpiWorldSize, mpiRank);
+
+    auto interval = config["Simulation"]["mpi_rebalance_interval"];
+    rebalanceInterval = interval.empty() ? 50 : std::stoi(interval);
+
+    // Ant is trivially copyable, so it's sent as a plain block of bytes
+    MPI_Type_contiguous(sizeof(Ant), MPI_BYTE, &mpiAntType);
+    MPI_Type_commit(&mpiAntType);
+}
+
+MpiBackend::~MpiBackend() {
+    // the simulation can end with a partition still being broadcast
+    if (partitionRequest != MPI_REQUEST_NULL) {
+        MPI_Wait(&partitionRequest, MPI_STATUS_IGNORE);
+    }
+    MPI_Type_free(&mpiAntType);
+    // the world's grids point into the window, but the world has already been destroyed by now
+    if (gridWindow != MPI_WIN_NULL) {
+        MPI_Win_unlock_all(gridWindow);
+        MPI_Win_free(&gridWindow);
+    }
+    for (auto subComm : {&nodeComm, &leaderComm}) {
+        if (*subComm != MPI_COMM_NULL) {
+            MPI_Comm_free(subComm);
+        }
+    }
+    if (ownsMpi) {
+        MPI_Finalize();
+    }
+}
+
+void MpiBackend::attach(World &world) {
+    world.threaded = hybrid;
+    if (hybrid) {
+        log_info("MPI rank %d will use %d OpenMP thread(s)", mpiRank, omp_get_max_threads());
+    }
+    // each rank only shares the cells it wrote
+    world.foodGrid.trackWrites();
+    world.pheromoneGrid.trackWrites();
+    shareGrids(world);
+
+    // every rank has the same world at this point, so they all come up with the same partition and no
+    // ants need to move
+    partition = balancedPartition(world);
+    log_info("MPI ranks are given an even share of the live ants, rebalanced every %d tick(s)", rebalanceInterval);
+}
+
+void MpiBackend::shareGrids(World &world) {
+    // ranks that can share memory (i.e. are on the same node) form a node, and the lowest rank of each
+    // node is its leader
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, mpiRank, MPI_INFO_NULL, &nodeComm);
+    MPI_Comm_rank(nodeComm, &nodeRank);
+    MPI_Comm_size(nodeComm, &nodeSize);
+    MPI_Comm_split(comm, nodeRank == 0 ? 0 : MPI_UNDEFINED, mpiRank, &leaderComm);
+    int numNodes = 0;
+    if (nodeRank == 0) {
+        MPI_Comm_size(leaderComm, &numNodes);
+    }
+    MPI_Bcast(&numNodes, 1, MPI_INT, 0, nodeComm);
+
+    // the grids are laid out one after the other in one window per node. this is called once to work out
+    // the size, then again to move each buffer into the window (the leader copies its contents over, which
+    // are the same on every rank at this point).
+    size_t offset = 0;
+    auto share = [&](auto &buffer, uint8_t *base) {
+        using T = std::remove_pointer_t<decltype(buffer.get())>;
+        auto bytes = buffer.bytes();
+        if (base != nullptr) {
+            auto memory = reinterpret_cast<T *>(base + offset);
+            if (nodeRank == 0) {
+                memcpy(memory, buffer.get(), bytes);
+            }
+            buffer = GridBuffer<T>(memory, buffer.size());
+        }
+        offset += (bytes + GRID_ALIGNMENT - 1) / GRID_ALIGNMENT * GRID_ALIGNMENT;
+    };
+    auto shareAll = [&](uint8_t *base) {
+        offset = 0;
+        share(world.foodGrid.clean, base);
+        share(world.foodGrid.dirty, base);
+        share(world.obstacleGrid.clean, base);
+        share(world.obstacleGrid.dirty, base);
+        share(world.pheromoneGrid.clean, base);
+        share(world.pheromoneGrid.dirty, base);
+        share(world.tileActive, base);
+        share(world.tileFood, base);
+        if (world.renderIntensity.get() != nullptr) {
+            share(world.renderIntensity, base);
+        }
+    };
+    shareAll(nullptr);
+    auto totalBytes = offset;
+
+    uint8_t *base = nullptr;
+    MPI_Win_allocate_shared(static_cast<MPI_Aint>(nodeRank == 0 ? totalBytes : 0), 1, MPI_INFO_NULL, nodeComm,
+                            &base, &gridWindow);
+    MPI_Aint windowBytes{};
+    int displacementUnit{};
+    MPI_Win_shared_query(gridWindow, 0, &windowBytes, &displacementUnit, &base);
+    // the window is only ever accessed with loads and stores, and kept in sync with syncNode()
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, gridWindow);
+    shareAll(base);
+    syncNode();
+    if (mpiRank == 0) {
+        log_info("MPI grids are shared between the ranks on each node (%d node(s), %zu bytes per node)", numNodes,
+                 totalBytes);
+    }
+}
+
+void MpiBackend::syncNode() const {
+    MPI_Win_sync(gridWindow);
+    MPI_Barrier(nodeComm);
+    MPI_Win_sync(gridWindow);
+}
+
+std::pair<int32_t, int32_t> MpiBackend::nodeTileRows(int32_t tilesY) const {
+    auto begin = static_cast<int32_t>(static_cast<int64_t>(tilesY) * nodeRank / nodeSize);
+    auto end = static_cast<int32_t>(static_cast<int64_t>(tilesY) * (nodeRank + 1) / nodeSize);
+    return {begin, end};
+}
+
+template<typename F>
+void MpiBackend::forEachRange(const World &world, const std::vector<AntIndex> &parts, int32_t rank, F &&fn) {
+    auto first = parts[rank];
+    auto last = parts[rank + 1];
+    for (int32_t c = first.colony; c <= last.colony && c < static_cast<int32_t>(world.colonies.size()); c++) {
+        int32_t begin = c == first.colony ? first.ant : 0;
+        int32_t end = c == last.colony ? last.ant : static_cast<int32_t>(world.colonies[c].ants.size());
+        if (begin < end) {
+            fn(AntRange{c, begin, end});
+        }
+    }
+}
+
+bool MpiBackend::update(World &world) {
+    // every rank constructed the same world from the same seed, and does exactly the same colony
+    // bookkeeping each tick, so the world RNG is the same on every rank and no seed needs to be sent
+    uint64_t seed = world.rng();
+    auto numColonies = world.colonies.size();
+
+    // ants die and are born at different rates in each colony, so every so often the ants are shared out
+    // again. the new partition was sent at the end of the last tick.
+    if (partitionRequest != MPI_REQUEST_NULL) {
+        MPI_Wait(&partitionRequest, MPI_STATUS_IGNORE);
+        rebalance(world);
+    }
+
+    // update our share of the ants (the master included)
+    std::vector<int32_t> colonyReturns(numColonies);
+    updateAnts(world, colonyReturns, seed);
+
+    // the master renders the world, so it needs every ant. nobody else does. this, and summing up how
+    // many ants returned to each colony, go on in the background while the grids are reduced.
+    startGatherAnts(world);
+    MPI_Request returnsRequest{};
+    MPI_Iallreduce(MPI_IN_PLACE, colonyReturns.data(), static_cast<int>(numColonies), MPI_INT32_T, MPI_SUM,
+                   comm, &returnsRequest);
+
+    // combine everyone's changes to the grids
+    reduceGridDeltas(world);
+
+    // spawning ants can move the colonies' ants arrays, so they must have arrived by now
+    MPI_Wait(&returnsRequest, MPI_STATUS_IGNORE);
+    finishGatherAnts();
+
+    // from here on, every rank does the same colony update as the serial update (including spawning ants
+    // for colonies it doesn't update, which keeps the world RNG and the colony sizes in sync)
+    std::vector<size_t> antCounts(numColonies);
+    for (size_t c = 0; c < numColonies; c++) {
+        auto &colony = world.colonies[c];
+        for (int32_t i = 0; i < colonyReturns[c]; i++) {
+            world.feedColony(colony, true);
+        }
+        antCounts[c] = colony.ants.size();
+    }
+    auto antsAlive = world.updateColonyStats(antCounts);
+
+    // the grids are shared by the node, so each of its ranks commits, decays and counts the food in a share
+    // of them. nobody can read the grids for the next tick until everyone is done, which the reduction of
+    // the food count takes care of.
+    auto [tyBegin, tyEnd] = nodeTileRows(world.tilesY);
+    world.foodGrid.commitRows(std::min(tyBegin * ACTIVITY_TILE_SIZE, world.height),
+                              std::min(tyEnd * ACTIVITY_TILE_SIZE, world.height));
+    world.foodGrid.clearWrites();
+    world.decayAndCommitPheromones(tyBegin, tyEnd);
+    world.pheromoneGrid.clearWrites();
+    int32_t foodRemaining = world.countFood(tyBegin, tyEnd);
+    MPI_Win_sync(gridWindow);
+    MPI_Allreduce(MPI_IN_PLACE, &foodRemaining, 1, MPI_INT32_T, MPI_SUM, nodeComm);
+    MPI_Win_sync(gridWindow);
+    bool shouldContinue = world.checkShouldContinue(antsAlive, foodRemaining);
+
+    // the master now has every ant as it will be at the start of the next tick, so if it's time to
+    // rebalance, it works out the new partition and sends it while it renders and the workers carry on
+    if (rebalanceInterval > 0 && ++ticksSinceRebalance >= rebalanceInterval) {
+        ticksSinceRebalance = 0;
+        if (mpiRank == 0) {
+            nextPartition = balancedPartition(world);
+        } else {
+            nextPartition.resize(mpiWorldSize + 1);
+        }
+        static_assert(sizeof(AntIndex) == 2 * sizeof(int32_t), "AntIndex is broadcast as pairs of int32s");
+        MPI_Ibcast(nextPartition.data(), static_cast<int>(nextPartition.size() * 2), MPI_INT32_T, 0,
+                   comm, &partitionRequest);
+    }
+    return shouldContinue;
+}
+
+void MpiBackend::updateAnts(World &world, std::vector<int32_t> &colonyReturns, uint64_t seed) const {
+    std::vector<AntRange> ranges{};
+    forEachRange(world, partition, mpiRank, [&](const AntRange &range) { ranges.push_back(range); });
+
+    // in hybrid mode, the ants in each range are spread over this rank's OpenMP threads
+#pragma omp parallel default(none) shared(world, ranges, colonyReturns, seed) if(world.threaded)
+    {
+        // setup thread local RNG
+        pcg32_fast localRng{};
+        localRng.seed(seed);
+
+        for (const auto &range : ranges) {
+            auto colony = &world.colonies[range.colony];
+            // skip dead colonies
+            if (colony->isDead) {
+                continue;
+            }
+#pragma omp for nowait
+            for (int32_t a = range.begin; a < range.end; a++) {
+                auto ant = &colony->ants[a];
+                // skip dead ants
+                if (ant->isDead) {
+                    continue;
+                }
+                // update the ant
+                if (world.updateAnt(ant, &colony->antMeta[a], colony, localRng)) {
+                    // record that we should add more ants to this colony
+#pragma omp atomic
+                    colonyReturns[range.colony]++;
+                }
+            } // end each ant in range loop
+        } // end each range loop
+    } // end OMP block
+}
+
+std::vector<MpiBackend::AntIndex> MpiBackend::balancedPartition(const World &world) const {
+    auto numColonies = static_cast<int32_t>(world.colonies.size());
+    auto countsTowardsLoad = [&](int32_t c, int32_t a) {
+        return !world.colonies[c].isDead && !world.colonies[c].ants[a].isDead;
+    };
+    size_t liveAnts = 0;
+    for (int32_t c = 0; c < numColonies; c++) {
+        for (int32_t a = 0; a < static_cast<int32_t>(world.colonies[c].ants.size()); a++) {
+            liveAnts += countsTowardsLoad(c, a);
+        }
+    }
+
+    // rank r starts at the first ant that has at least liveAnts * r / mpiWorldSize live ants before it.
+    // ranks that don't get a start this way (because there are trailing dead ants) start at the end.
+    std::vector<AntIndex> result(mpiWorldSize + 1, AntIndex{numColonies, 0});
+    result[0] = AntIndex{0, 0};
+    int32_t rank = 1;
+    size_t seen = 0;
+    for (int32_t c = 0; c < numColonies; c++) {
+        for (int32_t a = 0; a < static_cast<int32_t>(world.colonies[c].ants.size()); a++) {
+            while (rank < mpiWorldSize && seen >= liveAnts * rank / mpiWorldSize) {
+                result[rank++] = AntIndex{c, a};
+            }
+            seen += countsTowardsLoad(c, a);
+        }
+    }
+    return result;
+}
+
+void MpiBackend::rebalance(World &world) {
+    if (nextPartition == partition) {
+        return;
+    }
+    auto oldPartition = std::move(partition);
+    partition = std::move(nextPartition);
+    migrateAnts(world, oldPartition);
+    log_debug("Rebalanced MPI ants, rank %d now starts at colony %d ant %d", mpiRank, partition[mpiRank].colony,
+              partition[mpiRank].ant);
+}
+
+int32_t MpiBackend::ownerOf(const std::vector<AntIndex> &parts, AntIndex index) {
+    return static_cast<int32_t>(std::upper_bound(parts.begin(), parts.end(), index) - parts.begin()) - 1;
+}
+
+void MpiBackend::migrateAnts(World &world, const std::vector<AntIndex> &oldPartition) const {
+    // each ant we hand over is sent as its Ant record, its ID, the number of positions it visited and
+    // then the positions. walking our old range in order, the new owners only ever go up, so the ants
+    // for each destination end up contiguous in the send buffer.
+    std::vector<uint8_t> sendBuffer{};
+    std::vector<int> sendCounts(mpiWorldSize);
+    auto put = [&](const void *data, size_t size) {
+        auto bytes = static_cast<const uint8_t *>(data);
+        sendBuffer.insert(sendBuffer.end(), bytes, bytes + size);
+    };
+    forEachRange(world, oldPartition, mpiRank, [&](const AntRange &range) {
+        auto &colony = world.colonies[range.colony];
+        for (int32_t a = range.begin; a < range.end; a++) {
+            auto owner = ownerOf(partition, AntIndex{range.colony, a});
+            if (owner == mpiRank) {
+                continue;
+            }
+            auto sizeBefore = sendBuffer.size();
+            auto &meta = colony.antMeta[a];
+            auto numVisited = static_cast<uint32_t>(meta.visitedPos.size());
+            put(&colony.ants[a], sizeof(Ant));
+            put(&meta.id, sizeof(meta.id));
+            put(&numVisited, sizeof(numVisited));
+            for (const auto &pos : meta.visitedPos) {
+                put(&pos.x, sizeof(pos.x));
+                put(&pos.y, sizeof(pos.y));
+            }
+            sendCounts[owner] += static_cast<int>(sendBuffer.size() - sizeBefore);
+            // not ours any more
+            meta.visitedPos.clear();
+        }
+    });
+
+    std::vector<int> recvCounts(mpiWorldSize);
+    MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT, comm);
+    std::vector<int> sendDisplacements(mpiWorldSize), recvDisplacements(mpiWorldSize);
+    int sendTotal = 0, recvTotal = 0;
+    for (int32_t i = 0; i < mpiWorldSize; i++) {
+        sendDisplacements[i] = sendTotal;
+        recvDisplacements[i] = recvTotal;
+        sendTotal += sendCounts[i];
+        recvTotal += recvCounts[i];
+    }
+    std::vector<uint8_t> recvBuffer(recvTotal);
+    MPI_Alltoallv(sendBuffer.data(), sendCounts.data(), sendDisplacements.data(), MPI_BYTE,
+                  recvBuffer.data(), recvCounts.data(), recvDisplacements.data(), MPI_BYTE, comm);
+
+    // every rank knows both partitions, so the ants each source sent us are the ones in our new range
+    // that it used to own, in order
+    std::vector<size_t> cursors(recvDisplacements.begin(), recvDisplacements.end());
+    size_t received = 0;
+    forEachRange(world, partition, mpiRank, [&](const AntRange &range) {
+        auto &colony = world.colonies[range.colony];
+        for (int32_t a = range.begin; a < range.end; a++) {
+            auto source = ownerOf(oldPartition, AntIndex{range.colony, a});
+            if (source == mpiRank) {
+                continue;
+            }
+            auto &cursor = cursors[source];
+            auto get = [&](void *data, size_t size) {
+                std::copy_n(recvBuffer.data() + cursor, size, static_cast<uint8_t *>(data));
+                cursor += size;
+            };
+            auto &meta = colony.antMeta[a];
+            uint32_t numVisited{};
+            get(&colony.ants[a], sizeof(Ant));
+            get(&meta.id, sizeof(meta.id));
+            get(&numVisited, sizeof(numVisited));
+            meta.visitedPos.clear();
+            for (uint32_t i = 0; i < numVisited; i++) {
+                Vector2i pos{};
+                get(&pos.x, sizeof(pos.x));
+                get(&pos.y, sizeof(pos.y));
+                // the positions were sent in order, so each one goes at the end of the set
+                meta.visitedPos.insert(meta.visitedPos.end(), pos);
+            }
+            received++;
+        }
+    });
+    log_trace("Rank %d sent %d bytes of ants and received %zu ants", mpiRank, sendTotal, received);
+}
+
+MPI_Datatype MpiBackend::antsDatatype(World &world, int32_t rank) const {
+    // one block per range, pointing straight at that part of the colony's ants array
+    std::vector<int> blockLengths{};
+    std::vector<MPI_Aint> displacements{};
+    forEachRange(world, partition, rank, [&](const AntRange &range) {
+        MPI_Aint address{};
+        MPI_Get_address(&world.colonies[range.colony].ants[range.begin], &address);
+        blockLengths.push_back(range.end - range.begin);
+        displacements.push_back(address);
+    });
+    MPI_Datatype type{};
+    MPI_Type_create_hindexed(static_cast<int>(blockLengths.size()), blockLengths.data(), displacements.data(),
+                             mpiAntType, &type);
+    MPI_Type_commit(&type);
+    return type;
+}
+
+void MpiBackend::startGatherAnts(World &world) {
+    // the colony records themselves (hunger, ant counts, etc) are already the same on every rank, and only
+    // the rank updating an ant needs its AntMeta, so only the Ant records need to be sent. every rank
+    // knows which ants every other rank has, so they are received directly into the master's colonies.
+    // the datatypes can be freed straight away, MPI keeps them until the transfers are done.
+    if (mpiRank != 0) {
+        log_trace("Worker sending its ants back to master");
+        auto type = antsDatatype(world, mpiRank);
+        gatherRequests.resize(1);
+        MPI_Isend(MPI_BOTTOM, 1, type, 0, TAG_COLONY_DATA, comm, gatherRequests.data());
+        MPI_Type_free(&type);
+        return;
+    }
+
+    // start from the first worker (we don't want to receive from the master!!)
+    gatherRequests.resize(mpiWorldSize - 1);
+    for (int i = 1; i < mpiWorldSize; i++) {
+        auto type = antsDatatype(world, i);
+        MPI_Irecv(MPI_BOTTOM, 1, type, i, TAG_COLONY_DATA, comm, &gatherRequests[i - 1]);
+        MPI_Type_free(&type);
+    }
+}
+
+void MpiBackend::finishGatherAnts() {
+    MPI_Waitall(static_cast<int>(gatherRequests.size()), gatherRequests.data(), MPI_STATUSES_IGNORE);
+    gatherRequests.clear();
+}
+
+/**
+ * Gathers every rank's list into one list, in rank order
+ * @param root rank to gather to, or -1 to gather to every rank
+ * @return the gathered list on the receiving ranks, empty on the others
+ */
+template<typename T>
+static std::vector<T> gatherList(const std::vector<T> &local, MPI_Comm comm, int root) {
+    int rank{}, worldSize{};
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &worldSize);
+    int size = static_cast<int>(local.size() * sizeof(T));
+    std::vector<int> sizes(worldSize);
+    if (root < 0) {
+        MPI_Allgather(&size, 1, MPI_INT, sizes.data(), 1, MPI_INT, comm);
+    } else {
+        MPI_Gather(&size, 1, MPI_INT, sizes.data(), 1, MPI_INT, root, comm);
+    }
+    std::vector<int> displacements(worldSize);
+    int total = 0;
+    for (int32_t i = 0; i < worldSize; i++) {
+        displacements[i] = total;
+        total += sizes[i];
+    }
+    std::vector<T> all(total / sizeof(T));
+    if (root < 0) {
+        MPI_Allgatherv(local.data(), size, MPI_BYTE, all.data(), sizes.data(), displacements.data(), MPI_BYTE,
+                       comm);
+    } else {
+        MPI_Gatherv(local.data(), size, MPI_BYTE, all.data(), sizes.data(), displacements.data(), MPI_BYTE, root,
+                    comm);
+    }
+    return all;
+}
+
+/// Sorts the list and removes duplicates
+template<typename T>
+static void sortUnique(std::vector<T> &list) {
+    std::sort(list.begin(), list.end());
+    list.erase(std::unique(list.begin(), list.end()), list.end());
+}
+
+void MpiBackend::reduceGridDeltas(World &world) const {
+    auto &food = world.foodGrid;
+    auto &pheromones = world.pheromoneGrid;
+    uint64_t foodOffset = static_cast<uint64_t>(pheromones.width) * pheromones.height * pheromones.depth;
+
+    // cells this rank changed: the pheromone cells as they are, and food cells after all of those
+    std::vector<uint64_t> changed{};
+    changed.reserve(pheromones.writeLog.size() + food.writeLog.size());
+    for (auto cell : pheromones.writeLog) {
+        changed.push_back(cell);
+    }
+    for (auto cell : food.writeLog) {
+        if (food.dirty[cell] != food.clean[cell]) {
+            changed.push_back(foodOffset + cell);
+        }
+    }
+
+    // the ranks on a node all wrote into the same dirty grids, like OpenMP threads do, so there's only one
+    // set of changes per node. once everyone on the node is done, the leader collects the cells they changed.
+    syncNode();
+    auto cells = gatherList(changed, nodeComm, 0);
+    if (nodeRank != 0) {
+        // wait for the leader to fill in the changes from the other nodes
+        syncNode();
+        return;
+    }
+
+    // every leader works out the same sorted union of the cells any node changed...
+    sortUnique(cells);
+    cells = gatherList(cells, leaderComm, -1);
+    sortUnique(cells);
+
+    // ...and fills in its node's deltas for them. ants write clean + pheromoneGainFactor into the dirty
+    // buffer, so a node deposits at most once per cell and component each tick, and its delta is just
+    // whether it did. cells the node didn't write still have dirty == clean. the deltas are combined with a
+    // max, so a cell gets one gain however many nodes deposited on it, just like deposits from ranks on
+    // the same node (or OpenMP threads), and the result doesn't depend on how the ranks are spread out.
+    std::vector<int32_t> deltas(cells.size() * 2);
+    for (size_t i = 0; i < cells.size(); i++) {
+        auto cell = cells[i];
+        if (cell >= foodOffset) {
+            // food is only ever taken
+            cell -= foodOffset;
+            deltas[i * 2] = food.dirty[cell] != food.clean[cell];
+        } else {
+            deltas[i * 2] = pheromones.dirty[cell].toColony != pheromones.clean[cell].toColony;
+            deltas[i * 2 + 1] = pheromones.dirty[cell].toFood != pheromones.clean[cell].toFood;
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, deltas.data(), static_cast<int>(deltas.size()), MPI_INT32_T, MPI_MAX,
+                  leaderComm);
+
+    // apply the deltas to the clean grid, giving every node the same dirty grid
+    int32_t width = pheromones.width;
+    int32_t height = pheromones.height;
+    for (size_t i = 0; i < cells.size(); i++) {
+        auto cell = cells[i];
+        if (cell >= foodOffset) {
+            if (deltas[i * 2] > 0) {
+                food.dirty[cell - foodOffset] = false;
+            }
+            continue;
+        }
+        auto cur = pheromones.clean[cell];
+        if (deltas[i * 2] > 0) {
+            cur.toColony += world.pheromoneGainFactor;
+        }
+        if (deltas[i * 2 + 1] > 0) {
+            cur.toFood += world.pheromoneGainFactor;
+        }
+        pheromones.dirty[cell] = cur;
+        world.markTileActive(static_cast<int32_t>(cell % width), static_cast<int32_t>((cell / width) % height),
+                             static_cast<int32_t>(cell / (static_cast<uint64_t>(width) * height)));
+    }
+    log_trace("Reduced %zu changed cells", cells.size());
+    syncNode();
+}
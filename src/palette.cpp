@@ -0,0 +1,68 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#include "ants/palette.h"
+#include "tinycolor/tinycolormap.hpp"
+
+using namespace ants;
+
+/// Entries in the colour cube
+constexpr int32_t CUBE_SIZE = PALETTE_CUBE_LEVELS * PALETTE_CUBE_LEVELS * PALETTE_CUBE_LEVELS;
+
+FramePalette::FramePalette(const std::vector<RGBColour> &colonyColours) : colonyColours(colonyColours) {
+    entries = {RGBColour(0, 255, 0), RGBColour(128, 128, 128)};
+    auto numColonies = static_cast<int32_t>(colonyColours.size());
+
+    // the colonies get the same space as the colour cube would take, so there's always room for the
+    // same number of pheromone levels. they need at least two shades each to show hunger.
+    shades = numColonies == 0 ? 0 : std::min(CUBE_SIZE / numColonies - 1, PALETTE_MAX_SHADES);
+    if (shades >= 2) {
+        for (int32_t c = 0; c < numColonies; c++) {
+            antIndices.push_back(static_cast<uint8_t>(entries.size()));
+            entries.push_back(colonyColours[c]);
+            for (int32_t s = 0; s < shades; s++) {
+                entries.push_back(colonyColours[c] * (static_cast<double>(s) / (shades - 1)));
+            }
+        }
+    } else {
+        shades = 0;
+        for (int32_t r = 0; r < PALETTE_CUBE_LEVELS; r++) {
+            for (int32_t g = 0; g < PALETTE_CUBE_LEVELS; g++) {
+                for (int32_t b = 0; b < PALETTE_CUBE_LEVELS; b++) {
+                    auto level = [](int32_t l) {
+                        return static_cast<uint8_t>(std::lround(255.0 * l / (PALETTE_CUBE_LEVELS - 1)));
+                    };
+                    entries.emplace_back(level(r), level(g), level(b));
+                }
+            }
+        }
+        for (const auto &colour : colonyColours) {
+            antIndices.push_back(cubeIndex(colour));
+        }
+    }
+
+    infernoBase = static_cast<int32_t>(entries.size());
+    infernoLevels = PALETTE_SIZE - infernoBase;
+    for (int32_t i = 0; i < infernoLevels; i++) {
+        auto colour = tinycolormap::GetInfernoColor(static_cast<double>(i) / (infernoLevels - 1));
+        entries.emplace_back(colour.ri(), colour.gi(), colour.bi());
+    }
+}
+
+uint8_t FramePalette::colony(uint32_t colony, double hunger) const {
+    if (shades == 0) {
+        return cubeIndex(colonyColours[colony] * hunger);
+    }
+    auto shade = std::lround(std::clamp(hunger, 0.0, 1.0) * (shades - 1));
+    return static_cast<uint8_t>(antIndices[colony] + 1 + shade);
+}
+
+uint8_t FramePalette::cubeIndex(RGBColour colour) const {
+    auto level = [](uint8_t value) {
+        return static_cast<int32_t>(std::lround(value * (PALETTE_CUBE_LEVELS - 1) / 255.0));
+    };
+    return static_cast<uint8_t>(COLONY_BASE + (level(colour.r) * PALETTE_CUBE_LEVELS + level(colour.g)) *
+                                                  PALETTE_CUBE_LEVELS + level(colour.b));
+}
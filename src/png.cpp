@@ -0,0 +1,216 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <zlib.h>
+#include "ants/png.h"
+
+using namespace ants;
+
+/// PNG filter types, as per the spec
+enum PngFilter : uint8_t {
+    FILTER_NONE = 0,
+    FILTER_SUB,
+    FILTER_UP,
+    FILTER_AVERAGE,
+    FILTER_PAETH,
+    NUM_FILTERS
+};
+
+static inline uint8_t paethPredictor(int32_t a, int32_t b, int32_t c) {
+    int32_t p = a + b - c;
+    int32_t pa = std::abs(p - a);
+    int32_t pb = std::abs(p - b);
+    int32_t pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+/// Filters row (against the row above it, prior) into out, which starts with the filter type
+static void filterRow(const uint8_t *row, const uint8_t *prior, size_t rowBytes, int32_t bpp, uint8_t filter,
+                      uint8_t *out) {
+    out[0] = filter;
+    out++;
+    for (size_t i = 0; i < rowBytes; i++) {
+        // left, up and up-left; bytes before the start of the row count as 0
+        int32_t a = i >= static_cast<size_t>(bpp) ? row[i - bpp] : 0;
+        int32_t b = prior[i];
+        int32_t c = i >= static_cast<size_t>(bpp) ? prior[i - bpp] : 0;
+        switch (filter) {
+            case FILTER_NONE:
+                out[i] = row[i];
+                break;
+            case FILTER_SUB:
+                out[i] = row[i] - a;
+                break;
+            case FILTER_UP:
+                out[i] = row[i] - b;
+                break;
+            case FILTER_AVERAGE:
+                out[i] = row[i] - ((a + b) >> 1);
+                break;
+            default:
+                out[i] = row[i] - paethPredictor(a, b, c);
+                break;
+        }
+    }
+}
+
+/// Sum of the filtered bytes as signed values, the usual heuristic for which filter compresses best
+static uint64_t filterScore(const uint8_t *filtered, size_t rowBytes) {
+    uint64_t score = 0;
+    for (size_t i = 1; i <= rowBytes; i++) {
+        score += std::abs(static_cast<int8_t>(filtered[i]));
+    }
+    return score;
+}
+
+PngStrip ants::deflatePngStrip(const uint8_t *pixels, int32_t width, int32_t channels, int32_t yBegin,
+                               int32_t yEnd, bool last, bool indexed) {
+    auto rowBytes = static_cast<size_t>(width) * channels;
+    // each filtered row starts with its filter type
+    std::vector<uint8_t> filtered((rowBytes + 1) * (yEnd - yBegin));
+    std::vector<uint8_t> zeros(rowBytes), candidate(rowBytes + 1);
+    for (int32_t y = yBegin; y < yEnd; y++) {
+        auto row = pixels + y * rowBytes;
+        auto prior = y > 0 ? row - rowBytes : zeros.data();
+        auto out = filtered.data() + (y - yBegin) * (rowBytes + 1);
+        if (indexed) {
+            filterRow(row, prior, rowBytes, channels, FILTER_NONE, out);
+            continue;
+        }
+        auto bestScore = std::numeric_limits<uint64_t>::max();
+        for (uint8_t filter = FILTER_NONE; filter < NUM_FILTERS; filter++) {
+            filterRow(row, prior, rowBytes, channels, filter, candidate.data());
+            auto score = filterScore(candidate.data(), rowBytes);
+            if (score < bestScore) {
+                bestScore = score;
+                std::copy(candidate.begin(), candidate.end(), out);
+            }
+        }
+    }
+
+    PngStrip strip{};
+    strip.length = filtered.size();
+    strip.adler = adler32_z(adler32(0, Z_NULL, 0), filtered.data(), filtered.size());
+
+    // raw deflate (no zlib header), so the strips can be concatenated. a sync flush ends all but the last
+    // strip on a byte boundary without ending the stream.
+    z_stream stream{};
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Failed to initialise zlib deflate");
+    }
+    // the bound is for Z_FINISH, a sync flush can add a few more bytes
+    strip.deflated.resize(deflateBound(&stream, filtered.size()) + 16);
+    stream.next_in = filtered.data();
+    stream.avail_in = filtered.size();
+    stream.next_out = strip.deflated.data();
+    stream.avail_out = strip.deflated.size();
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    int err = deflate(&stream, flush);
+    bool done = last ? err == Z_STREAM_END : err == Z_OK && stream.avail_in == 0 && stream.avail_out != 0;
+    strip.deflated.resize(stream.total_out);
+    deflateEnd(&stream);
+    if (!done) {
+        std::ostringstream oss;
+        oss << "Failed to deflate PNG rows " << yBegin << " to " << yEnd << ": zlib error " << err;
+        throw std::runtime_error(oss.str());
+    }
+    return strip;
+}
+
+static void writeU32(std::vector<uint8_t> &out, uint32_t value) {
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+/// Writes a chunk, whose data is the concatenation of parts
+static void writeChunk(std::vector<uint8_t> &out, const char *type,
+                       const std::vector<std::pair<const uint8_t *, size_t>> &parts) {
+    size_t length = 0;
+    for (const auto &[data, size] : parts) {
+        length += size;
+    }
+    if (length > INT32_MAX) {
+        throw std::runtime_error("PNG chunk is too big");
+    }
+    writeU32(out, length);
+    auto typeBytes = reinterpret_cast<const uint8_t *>(type);
+    out.insert(out.end(), typeBytes, typeBytes + 4);
+    auto crc = crc32(0, typeBytes, 4);
+    for (const auto &[data, size] : parts) {
+        out.insert(out.end(), data, data + size);
+        crc = crc32_z(crc, data, size);
+    }
+    writeU32(out, crc);
+}
+
+std::vector<uint8_t> ants::assemblePng(int32_t width, int32_t height, int32_t channels,
+                                       const std::vector<PngStrip> &strips, const std::vector<RGBColour> &palette) {
+    uint8_t colourType;
+    switch (channels) {
+        case 1:
+            colourType = palette.empty() ? 0 : 3; // greyscale, or indexed colour
+            break;
+        case 3:
+            colourType = 2; // RGB
+            break;
+        case 4:
+            colourType = 6; // RGBA
+            break;
+        default:
+            throw std::invalid_argument("PNG images must have 1, 3 or 4 channels");
+    }
+    if (!palette.empty() && (colourType != 3 || palette.size() > 256)) {
+        throw std::invalid_argument("PNG palettes need 1 channel images, and at most 256 colours");
+    }
+
+    size_t deflatedSize = 0;
+    for (const auto &strip : strips) {
+        deflatedSize += strip.deflated.size();
+    }
+    std::vector<uint8_t> out{0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    out.reserve(out.size() + 64 + deflatedSize);
+
+    std::vector<uint8_t> header{};
+    writeU32(header, width);
+    writeU32(header, height);
+    // 8 bits per channel, deflate, adaptive filtering, no interlacing
+    header.insert(header.end(), {8, colourType, 0, 0, 0});
+    writeChunk(out, "IHDR", {{header.data(), header.size()}});
+
+    if (!palette.empty()) {
+        std::vector<uint8_t> plte{};
+        for (const auto &colour : palette) {
+            plte.insert(plte.end(), {colour.r, colour.g, colour.b});
+        }
+        writeChunk(out, "PLTE", {{plte.data(), plte.size()}});
+    }
+
+    // one zlib stream: the header, every strip's deflate data, then the Adler-32 of all the filtered rows
+    const uint8_t zlibHeader[2] = {0x78, 0x9C};
+    auto adler = adler32(0, Z_NULL, 0);
+    std::vector<std::pair<const uint8_t *, size_t>> parts{{zlibHeader, 2}};
+    for (const auto &strip : strips) {
+        parts.emplace_back(strip.deflated.data(), strip.deflated.size());
+        adler = adler32_combine(adler, strip.adler, static_cast<z_off_t>(strip.length));
+    }
+    std::vector<uint8_t> trailer{};
+    writeU32(trailer, adler);
+    parts.emplace_back(trailer.data(), trailer.size());
+    writeChunk(out, "IDAT", parts);
+
+    writeChunk(out, "IEND", {});
+    return out;
+}
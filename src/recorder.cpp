@@ -0,0 +1,264 @@
+// Copyright (c) 2022 Matt Young. All rights reserved.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+// If a copy of the MPL was not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include "ants/recorder.h"
+#include "ants/world.h"
+#include "log/log.h"
+
+using namespace ants;
+
+/// Frames are palette indices
+constexpr int32_t FRAME_CHANNELS = 1;
+
+RecordingSettings::RecordingSettings(mINI::INIStructure &config) {
+    auto &section = config["Simulation"];
+    auto format = section["recording_format"];
+    if (format == "native") {
+        this->format = RecordingFormat::NATIVE;
+    } else if (format == "events") {
+        this->format = RecordingFormat::EVENTS;
+    } else if (!format.empty() && format != "png") {
+        throw std::invalid_argument("Unknown recording_format '" + format + "' (expected png, native or events)");
+    }
+    if (!section["recording_threads"].empty()) {
+        numThreads = std::max(std::stoi(section["recording_threads"]), 1);
+    }
+    if (!section["recording_memory_mib"].empty()) {
+        memoryCap = std::stoul(section["recording_memory_mib"]) * BYTES2MIB;
+    }
+    if (!section["recording_strip_mib"].empty()) {
+        stripBytes = std::max<size_t>(std::stoul(section["recording_strip_mib"]) * BYTES2MIB, 1);
+    }
+    if (!section["recording_keyframe_interval"].empty()) {
+        keyframeInterval = std::stoi(section["recording_keyframe_interval"]);
+    }
+    if (!section["recording_stride"].empty()) {
+        stride = std::max(std::stoi(section["recording_stride"]), 1);
+    }
+    // negative ticks count back from the end of the simulation
+    auto readTick = [&](const std::string &key, int64_t &tick) {
+        if (section[key].empty()) {
+            return;
+        }
+        tick = std::stoll(section[key]);
+        if (tick < 0 && !section["simulate_ticks"].empty()) {
+            tick += std::stoll(section["simulate_ticks"]);
+        }
+    };
+    readTick("recording_first_tick", firstTick);
+    readTick("recording_last_tick", lastTick);
+    if (!section["recording_region"].empty()) {
+        auto value = section["recording_region"];
+        if (sscanf(value.c_str(), "%d,%d,%d,%d", &region.x, &region.y, &region.width, &region.height) != 4) {
+            throw std::invalid_argument("Invalid recording_region '" + value + "' (expected x,y,width,height)");
+        }
+    }
+    if (!section["recording_downsample"].empty()) {
+        region.downsample = std::max(std::stoi(section["recording_downsample"]), 1);
+    }
+    liveViewName = section["live_view_name"];
+    if (!section["live_view_slots"].empty()) {
+        // with one slot, the viewer would always be reading the frame being overwritten
+        liveViewSlots = std::max(std::stoi(section["live_view_slots"]), 2);
+    }
+    // the default window (and recording_last_tick = -1) covers every tick
+    int64_t endTick = section["simulate_ticks"].empty() ? INT64_MAX : std::stoll(section["simulate_ticks"]) - 1;
+    bool everyTick = stride == 1 && firstTick <= 0 && lastTick >= endTick;
+    if (this->format == RecordingFormat::EVENTS && (!everyTick || region.width != 0 || region.downsample != 1)) {
+        log_warn("The events format logs every tick of the whole world, ant_render picks the frames to render");
+    }
+}
+
+Recorder::Recorder(World &world, const RecordingSettings &settings) : world(world), settings(settings),
+    frameWidth(world.frameRegion.frameWidth()), frameHeight(world.frameRegion.frameHeight()) {
+    int32_t numEncoders = settings.numThreads;
+    std::vector<uint8_t> header{};
+    std::string extension{};
+    if (settings.format == RecordingFormat::NATIVE) {
+        // each frame is encoded against the last, so they have to be encoded in order on one thread
+        numEncoders = 1;
+        antrecEncoder = std::make_unique<AntrecEncoder>(frameWidth, frameHeight, settings.keyframeInterval,
+                                                        world.palette.colours());
+        header = antrecEncoder->encodeHeader();
+        extension = ".antrec";
+    } else if (settings.format == RecordingFormat::EVENTS) {
+        eventLogger = std::make_unique<EventLogger>(world);
+        header = eventLogger->encodeHeader();
+        extension = ".antlog";
+    }
+    if (settings.format != RecordingFormat::EVENTS) {
+        log_info("Recording %dx%d frames every %d tick(s), from tick %ld", frameWidth, frameHeight, settings.stride,
+                 settings.firstTick);
+    }
+    if (!extension.empty()) {
+        // next to the TAR, which still gets the statistics
+        auto path = world.recordingPath.substr(0, world.recordingPath.rfind(".tar")) + extension;
+        streamFile = std::make_unique<AsyncFileWriter>(path);
+        if (!streamFile->isOpen()) {
+            log_warn("Failed to create recording %s: %s", path.c_str(), strerror(errno));
+            streamFile.reset();
+        } else {
+            log_info("Opened recording %s for writing", path.c_str());
+            streamFile->write(header.data(), header.size());
+        }
+    }
+    for (int32_t i = 0; i < numEncoders; i++) {
+        encoders.emplace_back(&Recorder::encodeLoop, this);
+    }
+    writer = std::thread(&Recorder::writeLoop, this);
+}
+
+Recorder::~Recorder() {
+    finish();
+}
+
+void Recorder::push(std::vector<uint8_t> frame, int64_t tick) {
+    std::unique_lock lock(mutex);
+    // an empty queue always takes the frame, or a frame bigger than the cap would never get in
+    spaceFreed.wait(lock, [&] { return bytesQueued == 0 || bytesQueued + frame.size() <= settings.memoryCap; });
+    bytesQueued += frame.size();
+    peakBytesQueued = std::max(peakBytesQueued, bytesQueued);
+
+    auto job = std::make_shared<FrameJob>();
+    job->index = nextFrame++;
+    frameTicks.push_back(tick);
+    job->pixels = std::move(frame);
+    // at least one row per strip. native frames and event blocks are encoded whole.
+    size_t numStrips = 1;
+    if (settings.format == RecordingFormat::PNG) {
+        numStrips = std::clamp<size_t>((job->pixels.size() + settings.stripBytes - 1) / settings.stripBytes, 1,
+                                       frameHeight);
+    }
+    job->strips.resize(numStrips);
+    job->stripsLeft = numStrips;
+    for (size_t i = 0; i < numStrips; i++) {
+        rawStrips.emplace_back(job, i);
+    }
+    stripQueued.notify_all();
+}
+
+void Recorder::logEvents() {
+    // events are logged every tick
+    push(eventLogger->logTick(), static_cast<int64_t>(frameTicks.size()));
+}
+
+void Recorder::finish() {
+    if (!writer.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard lock(mutex);
+        finishing = true;
+    }
+    stripQueued.notify_all();
+    for (auto &encoder : encoders) {
+        encoder.join();
+    }
+    {
+        std::lock_guard lock(mutex);
+        encodersDone = true;
+    }
+    frameEncoded.notify_all();
+    writer.join();
+    if (streamFile != nullptr) {
+        streamFile->close();
+        streamFile.reset();
+    }
+    if (settings.format != RecordingFormat::EVENTS) {
+        std::ostringstream csv;
+        csv << "Frame,Tick\n";
+        for (size_t i = 0; i < frameTicks.size(); i++) {
+            csv << i << "," << frameTicks[i] << "\n";
+        }
+        auto data = csv.str();
+        world.writeToTar("frame_ticks.csv", reinterpret_cast<uint8_t *>(data.data()), data.size());
+    }
+}
+
+void Recorder::encodeLoop() {
+    while (true) {
+        std::unique_lock lock(mutex);
+        stripQueued.wait(lock, [&] { return !rawStrips.empty() || finishing; });
+        if (rawStrips.empty()) {
+            return;
+        }
+        auto [job, stripIndex] = std::move(rawStrips.front());
+        rawStrips.pop_front();
+        lock.unlock();
+
+        if (settings.format != RecordingFormat::PNG) {
+            auto encoded = antrecEncoder != nullptr ? antrecEncoder->encodeFrame(job->pixels.data())
+                                                    : compressLogBlock(job->pixels);
+            lock.lock();
+            bytesQueued = bytesQueued - job->pixels.size() + encoded.size();
+            encodedFrames.emplace(job->index, std::move(encoded));
+            lock.unlock();
+            frameEncoded.notify_one();
+            spaceFreed.notify_all();
+            continue;
+        }
+
+        auto numStrips = static_cast<int32_t>(job->strips.size());
+        auto yBegin = static_cast<int32_t>(frameHeight * stripIndex / numStrips);
+        auto yEnd = static_cast<int32_t>(frameHeight * (stripIndex + 1) / numStrips);
+        // frames are palette indices, so they're not filtered
+        auto strip = deflatePngStrip(job->pixels.data(), frameWidth, FRAME_CHANNELS, yBegin, yEnd,
+                                     yEnd == frameHeight, true);
+
+        lock.lock();
+        job->strips[stripIndex] = std::move(strip);
+        if (--job->stripsLeft != 0) {
+            continue;
+        }
+        lock.unlock();
+
+        // this was the frame's last strip, so put the PNG together
+        auto png = assemblePng(frameWidth, frameHeight, FRAME_CHANNELS, job->strips, world.palette.colours());
+        auto index = job->index;
+        auto rawSize = job->pixels.size();
+        job.reset();
+
+        lock.lock();
+        bytesQueued = bytesQueued - rawSize + png.size();
+        encodedFrames.emplace(index, std::move(png));
+        lock.unlock();
+        frameEncoded.notify_one();
+        spaceFreed.notify_all();
+    }
+}
+
+void Recorder::writeLoop() {
+    while (true) {
+        std::unique_lock lock(mutex);
+        frameEncoded.wait(lock, [&] { return encodedFrames.count(nextToWrite) != 0 || encodersDone; });
+        auto it = encodedFrames.find(nextToWrite);
+        if (it == encodedFrames.end()) {
+            // the encoders are done, and every frame has been written
+            return;
+        }
+        auto encoded = std::move(it->second);
+        encodedFrames.erase(it);
+        lock.unlock();
+
+        if (settings.format != RecordingFormat::PNG) {
+            if (streamFile != nullptr) {
+                streamFile->write(encoded.data(), encoded.size());
+            }
+        } else {
+            world.writeToTar(std::to_string(nextToWrite) + ".png", encoded.data(), encoded.size());
+        }
+
+        lock.lock();
+        bytesQueued -= encoded.size();
+        nextToWrite++;
+        lock.unlock();
+        spaceFreed.notify_all();
+    }
+}
@@ -4,6 +4,7 @@
 // If a copy of the MPL was not distributed with this file, You can obtain one at
 // http://mozilla.org/MPL/2.0/.
 #include <cstdint>
+#include <stdexcept>
 #include "ants/utils.h"
 
 using namespace ants;
@@ -89,4 +90,45 @@ void ants::hexdump(const void *ptr, size_t size) {
                 printf("%c", isprint(buf[i + j]) ? buf[i + j] : '.');
         printf("\n");
     }
-}
\ No newline at end of file
+}
+
+void ants::writeVarint(std::vector<uint8_t> &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+uint64_t ants::readVarint(const std::vector<uint8_t> &in, size_t &pos) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos >= in.size()) {
+            break;
+        }
+        uint8_t byte = in[pos++];
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    throw std::runtime_error("Corrupt recording: bad varint");
+}
+
+bool ants::readVarint(FILE *file, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(file);
+        if (byte == EOF) {
+            if (shift == 0) {
+                return false;
+            }
+            break;
+        }
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    throw std::runtime_error("Corrupt recording: truncated varint");
+}